@@ -32,16 +32,21 @@ echo "Building ninja manually..."
 mkdir -p build
 ./src/inline.sh kBrowsePy < src/browse.py > build/browse_py.h
 
+libs=-lpthread
 case "$SYSTEMNAME" in
   MINGW32*)
-    srcs=$(ls src/*.cc | grep -v test | grep -v subprocess.cc)
+    libs=
+    srcs=$(ls src/*.cc | grep -v test | grep -v subprocess.cc | grep -v watch.cc | grep -v uring.cc | grep -v server.cc | grep -v ninja_client.cc)
+    ;;
+  Linux)
+    srcs=$(ls src/*.cc | grep -v test | grep -v subprocess-win32.cc | grep -v ninja_client.cc)
     ;;
   *)
-    srcs=$(ls src/*.cc | grep -v test | grep -v subprocess-win32.cc)
+    srcs=$(ls src/*.cc | grep -v test | grep -v subprocess-win32.cc | grep -v watch.cc | grep -v uring.cc | grep -v ninja_client.cc)
     ;;
 esac
 
-${CXX:-g++} -Wno-deprecated ${CFLAGS} ${LDFLAGS} -o ninja.bootstrap $srcs
+${CXX:-g++} -Wno-deprecated ${CFLAGS} ${LDFLAGS} -o ninja.bootstrap $srcs $libs
 
 echo "Building ninja using itself..."
 ./configure.py
@@ -140,17 +140,27 @@ if platform not in ('mingw'):
     n.newline()
 
 n.comment('Core source files all build into ninja library.')
-for name in ['build', 'build_log', 'clean', 'eval_env', 'graph', 'graphviz',
-             'parsers', 'util', 'stat_cache', 'disk_interface', 'state']:
+for name in ['build', 'build_log', 'clean', 'command_output', 'eval_env',
+             'graph', 'graphviz', 'hash_cache', 'log_stats', 'memory_budget',
+             'parsers', 'util', 'stat_cache', 'disk_interface', 'state',
+             'throttle', 'trace']:
     objs += cxx(name)
 if platform == 'mingw':
     objs += cxx('subprocess-win32')
 else:
     objs += cxx('subprocess')
+    objs += cxx('jobserver')
+    objs += cxx('server')
+if platform == 'linux':
+    objs += cxx('uring')
+    objs += cxx('watch')
 ninja_lib = n.build(built('libninja.a'), 'ar', objs)
 n.newline()
 
 libs.append('-lninja')
+if platform != 'mingw':
+    # The build log is written on a thread of its own.
+    libs.append('-lpthread')
 
 n.comment('Main executable is library plus main() function.')
 objs = cxx('ninja')
@@ -158,6 +168,13 @@ n.build('ninja', 'link', objs, implicit=ninja_lib,
         variables=[('libs', libs)])
 n.newline()
 
+if platform != 'mingw':
+    n.comment('Client for a ninja running as a server.')
+    objs = cxx('ninja_client')
+    n.build('ninja_client', 'link', objs, implicit=ninja_lib,
+            variables=[('libs', libs)])
+    n.newline()
+
 n.comment('Tests all build into ninja_test executable.')
 
 variables = []
@@ -175,15 +192,26 @@ objs = []
 for name in ['build_log_test',
              'build_test',
              'clean_test',
+             'command_output_test',
              'disk_interface_test',
              'eval_env_test',
              'graph_test',
+             'hash_cache_test',
+             'log_stats_test',
+             'memory_budget_test',
              'parsers_test',
              'state_test',
              'subprocess_test',
              'test',
+             'throttle_test',
+             'trace_test',
              'util_test']:
     objs += cxx(name, variables=[('cflags', test_cflags)])
+if platform != 'mingw':
+    objs += cxx('jobserver_test', variables=[('cflags', test_cflags)])
+if platform == 'linux':
+    objs += cxx('uring_test', variables=[('cflags', test_cflags)])
+    objs += cxx('watch_test', variables=[('cflags', test_cflags)])
 
 if platform != 'mingw':
     test_libs.append('-lpthread')
@@ -192,10 +220,14 @@ n.build('ninja_test', 'link', objs, implicit=ninja_lib,
                    ('libs', test_libs)])
 n.newline()
 
-n.comment('Perftest executable.')
+n.comment('Perftest executables.')
 objs = cxx('parser_perftest')
 n.build('parser_perftest', 'link', objs, implicit=ninja_lib,
-        variables=[('libs', '-L$builddir -lninja')])
+        variables=[('libs', libs)])
+if platform != 'mingw':
+    objs = cxx('spawn_perftest')
+    n.build('spawn_perftest', 'link', objs, implicit=ninja_lib,
+            variables=[('libs', libs)])
 n.newline()
 
 n.comment('Generate a graph using the "graph" tool.')
@@ -17,6 +17,8 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <algorithm>
+
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -28,22 +30,31 @@
 #include "build_log.h"
 #include "disk_interface.h"
 #include "graph.h"
+#include "hash_cache.h"
+#ifndef _WIN32
+#include "jobserver.h"
+#endif
+#include "memory_budget.h"
 #include "state.h"
 #include "subprocess.h"
+#include "throttle.h"
+#include "trace.h"
 #include "util.h"
 
 /// Tracks the status of a build: completion fraction, printing updates.
 struct BuildStatus {
-  BuildStatus(const BuildConfig& config);
+  BuildStatus(const BuildConfig& config, const Throttle* throttle);
   void PlanHasTotalEdges(int total);
   void BuildEdgeStarted(Edge* edge);
-  void BuildEdgeFinished(Edge* edge, bool success, const string& output,
+  void BuildEdgeFinished(Edge* edge, bool success,
+                         const CommandOutput& output,
                          int* start_time, int* end_time);
 
  private:
   void PrintStatus(Edge* edge);
 
   const BuildConfig& config_;
+  const Throttle* throttle_;
 
   /// Time the build started.
   int64_t start_time_millis_;
@@ -60,8 +71,8 @@ struct BuildStatus {
   bool smart_terminal_;
 };
 
-BuildStatus::BuildStatus(const BuildConfig& config)
-    : config_(config),
+BuildStatus::BuildStatus(const BuildConfig& config, const Throttle* throttle)
+    : config_(config), throttle_(throttle),
       start_time_millis_(GetTimeMillis()),
       last_update_millis_(start_time_millis_),
       started_edges_(0), finished_edges_(0), total_edges_(0) {
@@ -91,7 +102,7 @@ void BuildStatus::BuildEdgeStarted(Edge* edge) {
 
 void BuildStatus::BuildEdgeFinished(Edge* edge,
                                     bool success,
-                                    const string& output,
+                                    const CommandOutput& output,
                                     int* start_time,
                                     int* end_time) {
   int64_t now = GetTimeMillis();
@@ -128,8 +139,7 @@ void BuildStatus::BuildEdgeFinished(Edge* edge,
     if (!success)
       printf("FAILED: %s\n", edge->EvaluateCommand().c_str());
 
-    if (!output.empty())
-      printf("%s", output.c_str());
+    output.Print(stdout);
   }
 }
 
@@ -146,7 +156,13 @@ void BuildStatus::PrintStatus(Edge* edge) {
   if (smart_terminal_)
     printf("\r");  // Print over previous line, if any.
 
-  int progress_chars = printf("[%d/%d] ", started_edges_, total_edges_);
+  int progress_chars;
+  if (throttle_->enabled()) {
+    progress_chars = printf("[%d/%d %s] ", started_edges_, total_edges_,
+                            throttle_->Describe().c_str());
+  } else {
+    progress_chars = printf("[%d/%d] ", started_edges_, total_edges_);
+  }
 
 #ifndef WIN32
   if (smart_terminal_ && !force_full_command) {
@@ -215,7 +231,7 @@ bool Plan::AddSubTarget(Node* node, vector<Node*>* stack, string* err) {
     ++wanted_edges_;
     if (find_if(edge->inputs_.begin(), edge->inputs_.end(),
                 not1(mem_fun(&Node::ready))) == edge->inputs_.end())
-      ready_.insert(edge);
+      ScheduleWork(edge);
     if (!edge->is_phony())
       ++command_edges_;
   }
@@ -255,20 +271,56 @@ bool Plan::CheckDependencyCycle(Node* node, vector<Node*>* stack, string* err) {
   return true;
 }
 
-Edge* Plan::FindWork() {
+Edge* Plan::FindWork(MemoryBudget* budget) {
   if (ready_.empty())
     return NULL;
+  // Only the next edge is tried: looking further for one that fits would
+  // cost an estimate per ready edge on every wakeup.  It fits once enough
+  // of the running commands finish.
   set<Edge*>::iterator i = ready_.begin();
   Edge* edge = *i;
+  if (budget && !budget->Fits(edge))
+    return NULL;
   ready_.erase(i);
   return edge;
 }
 
+void Plan::ScheduleWork(Edge* edge) {
+  // An edge that takes several outputs of one edge, or one input twice,
+  // is found ready once for each.
+  if (!scheduled_.insert(edge).second)
+    return;
+  if (edge->pool_) {
+    PoolQueue& pool = pools_[edge->pool_];
+    if (pool.in_use >= edge->pool_->depth_) {
+      pool.waiting.push(edge);
+      return;
+    }
+    ++pool.in_use;
+  }
+  ready_.insert(edge);
+}
+
+void Plan::ReleasePool(Edge* edge) {
+  if (!edge->pool_)
+    return;
+  PoolQueue& pool = pools_[edge->pool_];
+  --pool.in_use;
+  if (!pool.waiting.empty()) {
+    ++pool.in_use;
+    ready_.insert(pool.waiting.front());
+    pool.waiting.pop();
+  }
+}
+
 void Plan::EdgeFinished(Edge* edge) {
   map<Edge*, bool>::iterator i = want_.find(edge);
   assert(i != want_.end());
-  if (i->second)
+  if (i->second) {
     --wanted_edges_;
+    ReleasePool(edge);
+  }
+  scheduled_.erase(edge);
   want_.erase(i);
   edge->outputs_ready_ = true;
 
@@ -279,6 +331,11 @@ void Plan::EdgeFinished(Edge* edge) {
   }
 }
 
+void Plan::EdgeFailed(Edge* edge) {
+  ReleasePool(edge);
+  scheduled_.erase(edge);
+}
+
 void Plan::NodeFinished(Node* node) {
   // See if we we want any edges from this node.
   for (vector<Edge*>::iterator i = node->out_edges_.begin();
@@ -291,7 +348,7 @@ void Plan::NodeFinished(Node* node) {
     if (find_if((*i)->inputs_.begin(), (*i)->inputs_.end(),
                 not1(mem_fun(&Node::ready))) == (*i)->inputs_.end()) {
       if (want_i->second) {
-        ready_.insert(*i);
+        ScheduleWork(*i);
       } else {
         // We do not need to build this edge, but we might need to build one of
         // its dependents.
@@ -301,7 +358,7 @@ void Plan::NodeFinished(Node* node) {
   }
 }
 
-void Plan::CleanNode(BuildLog* build_log, Node* node) {
+void Plan::CleanNode(BuildLog* build_log, HashCache* hash_cache, Node* node) {
   node->dirty_ = false;
 
   for (vector<Edge*>::iterator ei = node->out_edges_.begin();
@@ -317,7 +374,7 @@ void Plan::CleanNode(BuildLog* build_log, Node* node) {
                             end = (*ei)->inputs_.end() - (*ei)->order_only_deps_;
     if (find_if(begin, end, mem_fun(&Node::dirty)) == end) {
       // Recompute most_recent_input and command.
-      time_t most_recent_input = 1;
+      TimeStamp most_recent_input = 1;
       for (vector<Node*>::iterator ni = begin; ni != end; ++ni)
         if ((*ni)->file_->mtime_ > most_recent_input)
           most_recent_input = (*ni)->file_->mtime_;
@@ -335,12 +392,12 @@ void Plan::CleanNode(BuildLog* build_log, Node* node) {
 
         // Since we know that all non-order-only inputs are clean, we can pass
         // "false" as the "dirty" argument here.
-        (*ei)->RecomputeOutputDirty(build_log, most_recent_input, false,
-                                    command, *ni);
+        (*ei)->RecomputeOutputDirty(build_log, hash_cache, most_recent_input,
+                                    false, command, *ni);
         if ((*ni)->dirty_) {
           all_outputs_clean = false;
         } else {
-          CleanNode(build_log, *ni);
+          CleanNode(build_log, hash_cache, *ni);
         }
       }
 
@@ -355,6 +412,15 @@ void Plan::CleanNode(BuildLog* build_log, Node* node) {
   }
 }
 
+void Plan::WantedOutputs(vector<Node*>* outputs) const {
+  for (map<Edge*, bool>::const_iterator i = want_.begin();
+       i != want_.end(); ++i) {
+    if (i->second && !i->first->is_phony())
+      outputs->insert(outputs->end(),
+                      i->first->outputs_.begin(), i->first->outputs_.end());
+  }
+}
+
 void Plan::Dump() {
   printf("pending: %d\n", (int)want_.size());
   for (map<Edge*, bool>::iterator i = want_.begin(); i != want_.end(); ++i) {
@@ -366,44 +432,100 @@ void Plan::Dump() {
 }
 
 struct RealCommandRunner : public CommandRunner {
-  RealCommandRunner(const BuildConfig& config) : config_(config) {}
+  RealCommandRunner(const BuildConfig& config, Throttle* throttle);
   virtual ~RealCommandRunner() {}
   virtual bool CanRunMore();
   virtual bool StartCommand(Edge* edge);
-  virtual Edge* WaitForCommand(bool* success, string* output);
+  virtual Edge* WaitForCommand(bool* success, CommandOutput* output,
+                               ResourceUsage* usage);
 
   const BuildConfig& config_;
+  Throttle* throttle_;
   SubprocessSet subprocs_;
   map<Subprocess*, Edge*> subproc_to_edge_;
+#ifndef _WIN32
+  /// Give back the jobserver tokens not needed by the running commands.
+  void ReleaseSpareTokens();
+
+  Jobserver jobserver_;
+#endif
 };
 
+RealCommandRunner::RealCommandRunner(const BuildConfig& config,
+                                     Throttle* throttle)
+    : config_(config), throttle_(throttle) {
+  subprocs_.output_limit_ = config.output_limit;
+#ifndef _WIN32
+  // Share the jobserver of a make we run under, or else be one for any
+  // make (or ninja) we run, so nested builds stay within one -j.
+  string err;
+  const char* makeflags = getenv("MAKEFLAGS");
+  if (!makeflags || !jobserver_.Connect(makeflags, &err)) {
+    if (!err.empty())
+      Warning("%s; using -j%d", err.c_str(), config.parallelism);
+    err.clear();
+    if (config.parallelism > 1 && !jobserver_.Create(config.parallelism, &err))
+      Warning("%s; not sharing -j with subcommands", err.c_str());
+  }
+#endif
+}
+
 bool RealCommandRunner::CanRunMore() {
-  return ((int)subprocs_.running_.size()) < config_.parallelism;
+  int commands = (int)subproc_to_edge_.size();
+  throttle_->Update(GetTimeMillis());
+  if (commands >= throttle_->limit())
+    return false;
+#ifndef _WIN32
+  // Each command after the first needs a token.  One may be left over
+  // from a call whose command didn't start.
+  if (jobserver_.enabled() && commands > 0)
+    return jobserver_.tokens() >= commands || jobserver_.Acquire();
+#endif
+  return true;
 }
 
+#ifndef _WIN32
+void RealCommandRunner::ReleaseSpareTokens() {
+  int needed = max((int)subproc_to_edge_.size() - 1, 0);
+  while (jobserver_.tokens() > needed)
+    jobserver_.Release();
+}
+#endif
+
 bool RealCommandRunner::StartCommand(Edge* edge) {
   string command = edge->EvaluateCommand();
   Subprocess* subproc = new Subprocess;
   subproc_to_edge_.insert(make_pair(subproc, edge));
-  if (!subproc->Start(&subprocs_, command))
+  if (!subproc->Start(&subprocs_, command, edge->rule_->shell_))
     return false;
 
   subprocs_.Add(subproc);
   return true;
 }
 
-Edge* RealCommandRunner::WaitForCommand(bool* success, string* output) {
+Edge* RealCommandRunner::WaitForCommand(bool* success,
+                                        CommandOutput* output,
+                                        ResourceUsage* usage) {
+#ifndef _WIN32
+  // Don't sit on a token while waiting.
+  ReleaseSpareTokens();
+#endif
   Subprocess* subproc;
   while ((subproc = subprocs_.NextFinished()) == NULL) {
-    subprocs_.DoWork();
+    if (subprocs_.DoWork())
+      return NULL;
   }
 
   *success = subproc->Finish();
-  *output = subproc->GetOutput();
+  subproc->TakeOutput(output);
+  *usage = subproc->usage();
 
   map<Subprocess*, Edge*>::iterator i = subproc_to_edge_.find(subproc);
   Edge* edge = i->second;
   subproc_to_edge_.erase(i);
+#ifndef _WIN32
+  ReleaseSpareTokens();
+#endif
 
   delete subproc;
   return edge;
@@ -419,7 +541,8 @@ struct DryRunCommandRunner : public CommandRunner {
     finished_.push(edge);
     return true;
   }
-  virtual Edge* WaitForCommand(bool* success, string* output) {
+  virtual Edge* WaitForCommand(bool* success, CommandOutput* output,
+                               ResourceUsage* usage) {
     if (finished_.empty())
       return NULL;
     *success = true;
@@ -432,14 +555,28 @@ struct DryRunCommandRunner : public CommandRunner {
 };
 
 Builder::Builder(State* state, const BuildConfig& config)
-    : state_(state), config_(config) {
+    : state_(state), config_(config), trace_(NULL) {
   disk_interface_ = new RealDiskInterface;
+  throttle_ = new Throttle(config.parallelism, config.max_load_average,
+                           config.max_pressure);
   if (config.dry_run)
     command_runner_ = new DryRunCommandRunner;
   else
-    command_runner_ = new RealCommandRunner(config);
-  status_ = new BuildStatus(config);
+    command_runner_ = new RealCommandRunner(config, throttle_);
+  status_ = new BuildStatus(config, throttle_);
   log_ = state->build_log_;
+  int64_t budget_kb = config.memory_budget_kb;
+  if (budget_kb < 0)
+    budget_kb = config.dry_run ? 0 : GetAvailableMemoryKB();
+  memory_budget_ = new MemoryBudget(budget_kb, log_);
+}
+
+Builder::~Builder() {
+  delete status_;
+  delete command_runner_;
+  delete memory_budget_;
+  delete throttle_;
+  delete disk_interface_;
 }
 
 Node* Builder::AddTarget(const string& name, string* err) {
@@ -454,6 +591,10 @@ Node* Builder::AddTarget(const string& name, string* err) {
 }
 
 bool Builder::AddTarget(Node* node, string* err) {
+  // Nothing is modified while scanning, so stats can be served from cached
+  // directory listings until the build starts.
+  disk_interface_->AllowStatCache(true);
+  Prefetch(node);
   node->file_->StatIfNecessary(disk_interface_);
   if (Edge* in_edge = node->in_edge_) {
     if (!in_edge->RecomputeDirty(state_, disk_interface_, err))
@@ -468,6 +609,92 @@ bool Builder::AddTarget(Node* node, string* err) {
   return true;
 }
 
+namespace {
+
+/// Whether \a edge's outputs are missing, or older than an input named
+/// in the manifest, so that it is dirty whatever its depfile says; the
+/// same test RecomputeDirty() makes before it visits the depfile deps.
+/// The nodes' status is left for the scan to fill in, as it only visits
+/// the edges behind inputs it hasn't stat()ed yet.
+bool OutputsStale(Edge* edge, State* state, DiskInterface* disk_interface) {
+  TimeStamp most_recent_input = 1;
+  for (size_t i = 0; i < edge->inputs_.size(); ++i) {
+    if (edge->is_depfile_dep(i) || edge->is_order_only(i))
+      continue;
+    TimeStamp mtime = disk_interface->Stat(edge->inputs_[i]->file_->path_);
+    most_recent_input = max(most_recent_input, mtime);
+  }
+  bool by_mtime = !edge->rule_->restat_ && !state->hash_cache_;
+  for (vector<Node*>::iterator i = edge->outputs_.begin();
+       i != edge->outputs_.end(); ++i) {
+    TimeStamp mtime = disk_interface->Stat((*i)->file_->path_);
+    if (mtime <= 0 || (by_mtime && mtime < most_recent_input))
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+void Builder::Prefetch(Node* target) {
+  // Without a batched backend this would only do the scan's work early.
+  if (!disk_interface_->CanPrefetch())
+    return;
+
+  // Walk the part of the graph the scan will visit, in rounds.  A round
+  // stats the nodes walked and reads the depfiles of the edges the last
+  // round found clean so far; the deps those name are walked next.  Like
+  // the scan, skip the depfiles of edges already known to be dirty.
+  set<Node*> seen_nodes;
+  set<Edge*> seen_edges;
+  vector<Node*> stack(1, target);
+  vector<Edge*> depfile_edges;
+  while (!stack.empty() || !depfile_edges.empty()) {
+    vector<string> stat_paths, depfiles;
+    vector<Edge*> walked_edges;
+    while (!stack.empty()) {
+      Node* node = stack.back();
+      stack.pop_back();
+      if (node->file_->status_known() || !seen_nodes.insert(node).second)
+        continue;
+      stat_paths.push_back(node->file_->path_);
+      Edge* edge = node->in_edge_;
+      if (!edge || !seen_edges.insert(edge).second)
+        continue;
+      stack.insert(stack.end(), edge->inputs_.begin(), edge->inputs_.end());
+      stack.insert(stack.end(), edge->outputs_.begin(), edge->outputs_.end());
+      if (!edge->rule_->depfile_.empty())
+        walked_edges.push_back(edge);
+    }
+    for (vector<Edge*>::iterator i = depfile_edges.begin();
+         i != depfile_edges.end(); ++i) {
+      depfiles.push_back((*i)->EvaluateDepFile());
+    }
+
+    disk_interface_->Prefetch(stat_paths, depfiles);
+
+    for (vector<Edge*>::iterator i = depfile_edges.begin();
+         i != depfile_edges.end(); ++i) {
+      // Errors are left for RecomputeDirty() to find and report.
+      string err;
+      if (!(*i)->LoadDepFile(state_, disk_interface_, &err))
+        continue;
+      (*i)->depfile_loaded_ = true;
+      vector<Node*>::iterator end = (*i)->inputs_.end() -
+          (*i)->order_only_deps_;
+      stack.insert(stack.end(), end - (*i)->depfile_deps_, end);
+    }
+    depfile_edges.clear();
+
+    // The files involved were all stat()ed in this round's batch.
+    for (vector<Edge*>::iterator i = walked_edges.begin();
+         i != walked_edges.end(); ++i) {
+      if (!OutputsStale(*i, state_, disk_interface_))
+        depfile_edges.push_back(*i);
+    }
+  }
+}
+
 bool Builder::AlreadyUpToDate() const {
   return !plan_.more_to_do();
 }
@@ -475,6 +702,27 @@ bool Builder::AlreadyUpToDate() const {
 bool Builder::Build(string* err) {
   assert(!AlreadyUpToDate());
 
+  // Commands will modify the disk, so restat must see fresh timestamps.
+  disk_interface_->AllowStatCache(false);
+
+  if (config_.make_dirs_first) {
+    vector<Node*> outputs;
+    plan_.WantedOutputs(&outputs);
+    for (vector<Node*>::iterator i = outputs.begin(); i != outputs.end(); ++i) {
+      if (!MakeOutputDirs(*i, err))
+        return false;
+    }
+  }
+
+  // Learn what each rule needs from its commands that have run before,
+  // for the commands that haven't.
+  if (memory_budget_->budget_kb() && log_) {
+    vector<Node*> outputs;
+    plan_.WantedOutputs(&outputs);
+    for (vector<Node*>::iterator i = outputs.begin(); i != outputs.end(); ++i)
+      memory_budget_->Learn((*i)->in_edge_);
+  }
+
   status_->PlanHasTotalEdges(plan_.command_edge_count());
   int pending_commands = 0;
   int failures_allowed = config_.swallow_failures;
@@ -489,14 +737,16 @@ bool Builder::Build(string* err) {
   while (plan_.more_to_do()) {
     // See if we can start any more commands.
     if (command_runner_->CanRunMore()) {
-      if (Edge* edge = plan_.FindWork()) {
+      if (Edge* edge = plan_.FindWork(memory_budget_)) {
         if (!StartEdge(edge, err))
           return false;
 
-        if (edge->is_phony())
-          FinishEdge(edge, true, "");
-        else
+        if (edge->is_phony()) {
+          CommandOutput no_output;
+          FinishEdge(edge, true, no_output, ResourceUsage());
+        } else {
           ++pending_commands;
+        }
 
         // We made some progress; go back to the main loop.
         continue;
@@ -506,11 +756,15 @@ bool Builder::Build(string* err) {
     // See if we can reap any finished commands.
     if (pending_commands) {
       bool success;
-      string output;
-      Edge* edge;
-      if ((edge = command_runner_->WaitForCommand(&success, &output))) {
+      CommandOutput output;
+      ResourceUsage usage;
+      int64_t wait_start = trace_ ? trace_->Now() : 0;
+      Edge* edge = command_runner_->WaitForCommand(&success, &output, &usage);
+      if (trace_)
+        trace_->AddPhase("wait for commands", wait_start, trace_->Now());
+      if (edge) {
         --pending_commands;
-        FinishEdge(edge, success, output);
+        FinishEdge(edge, success, output, usage);
         if (!success) {
           if (failures_allowed-- == 0) {
             if (config_.swallow_failures != 0)
@@ -523,15 +777,13 @@ bool Builder::Build(string* err) {
 
         // We made some progress; start the main loop over.
         continue;
+      } else {
+        *err = "interrupted by user";
+        return false;
       }
     }
 
     // If we get here, we can neither enqueue new commands nor are any running.
-    if (pending_commands) {
-      *err = "stuck: pending commands but none to wait for? [this is a bug]";
-      return false;
-    }
-
     // If we get here, we cannot make any more progress.
     if (failures_allowed < config_.swallow_failures) {
       *err = "cannot make progress due to previous errors";
@@ -550,51 +802,107 @@ bool Builder::StartEdge(Edge* edge, string* err) {
     return true;
 
   status_->BuildEdgeStarted(edge);
+  if (trace_)
+    trace_->CommandStarted(edge);
 
-  // Create directories necessary for outputs.
-  // XXX: this will block; do we care?
+  // Create directories necessary for outputs.  Most edges share their
+  // output directory with an edge that ran earlier, so this rarely blocks.
   for (vector<Node*>::iterator i = edge->outputs_.begin();
        i != edge->outputs_.end(); ++i) {
-    if (!disk_interface_->MakeDirs((*i)->file_->path_))
+    if (!MakeOutputDirs(*i, err))
       return false;
   }
 
+  // Hash the inputs now, so that edits made while the command runs
+  // aren't mistaken for what it was built from.
+  HashCache* hash_cache = state_->hash_cache_;
+  if (hash_cache && !config_.dry_run) {
+    StartHashes& hashes = start_hashes_[edge];
+    if (!edge->HashInputs(hash_cache, &hashes.inputs))
+      hashes.inputs = 0;
+    hashes.outputs.resize(edge->outputs_.size());
+    for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+      if (!edge->outputs_[i]->file_->exists() ||
+          !hash_cache->GetHash(edge->outputs_[i]->file_->path_,
+                               &hashes.outputs[i]))
+        hashes.outputs[i] = 0;
+    }
+  }
+
   // Compute command and start it.
   string command = edge->EvaluateCommand();
   if (!command_runner_->StartCommand(edge)) {
     err->assign("command '" + command + "' failed.");
     return false;
   }
+  memory_budget_->CommandStarted(edge);
 
   return true;
 }
 
-void Builder::FinishEdge(Edge* edge, bool success, const string& output) {
-  time_t restat_mtime = 0;
+bool Builder::MakeOutputDirs(Node* node, string* err) {
+  if (!disk_interface_->MakeDirs(node->file_->path_, &known_dirs_)) {
+    *err = "creating directories for " + node->file_->path_;
+    return false;
+  }
+  return true;
+}
+
+void Builder::FinishEdge(Edge* edge, bool success,
+                         const CommandOutput& output,
+                         const ResourceUsage& usage) {
+  TimeStamp restat_mtime = 0;
+  HashCache* hash_cache = state_->hash_cache_;
+  StartHashes hashes;
+  map<Edge*, StartHashes>::iterator h = start_hashes_.find(edge);
+  if (h != start_hashes_.end()) {
+    hashes.inputs = h->second.inputs;
+    hashes.outputs.swap(h->second.outputs);
+    start_hashes_.erase(h);
+  }
+
+  // The command may have rewritten its depfile.
+  edge->depfile_loaded_ = false;
 
   if (success) {
-    if (edge->rule_->restat_) {
+    if (edge->rule_->restat_ || !hashes.outputs.empty()) {
       bool node_cleaned = false;
 
-      for (vector<Node*>::iterator i = edge->outputs_.begin();
-           i != edge->outputs_.end(); ++i) {
-        if ((*i)->file_->exists()) {
-          time_t new_mtime = disk_interface_->Stat((*i)->file_->path_);
-          if ((*i)->file_->mtime_ == new_mtime) {
-            // The rule command did not change the output.  Propagate the clean
-            // state through the build graph.
-            plan_.CleanNode(log_, *i);
-            node_cleaned = true;
-          }
+      for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+        Node* node = edge->outputs_[i];
+        if (!node->file_->exists()) {
+          node->file_->mtime_ = -1;
+          continue;
+        }
+        TimeStamp new_mtime = disk_interface_->Stat(node->file_->path_);
+        bool unchanged = false;
+        uint64_t new_hash;
+        if (edge->rule_->restat_ && node->file_->mtime_ == new_mtime) {
+          // The rule command did not change the output.
+          unchanged = true;
+        } else if (!hashes.outputs.empty() && hashes.outputs[i] &&
+                   hash_cache->GetHash(node->file_->path_, &new_hash) &&
+                   new_hash == hashes.outputs[i]) {
+          // The rule command rewrote the output with the same contents.
+          // Dependents compare the new mtime against their content hashes.
+          unchanged = true;
+        }
+        node->file_->mtime_ = new_mtime;
+        if (unchanged) {
+          // Propagate the clean state through the build graph.
+          plan_.CleanNode(log_, hash_cache, node);
+          node_cleaned = true;
         }
       }
 
-      if (node_cleaned) {
+      if (node_cleaned && edge->rule_->restat_) {
         // If any output was cleaned, find the most recent mtime of any
-        // (existing) non-order-only input.
+        // (existing) non-order-only input.  The scan stat()ed every input,
+        // and inputs built since then were marked for a fresh stat.
         for (vector<Node*>::iterator i = edge->inputs_.begin();
              i != edge->inputs_.end() - edge->order_only_deps_; ++i) {
-          time_t input_mtime = disk_interface_->Stat((*i)->file_->path_);
+          (*i)->file_->StatIfNecessary(disk_interface_);
+          TimeStamp input_mtime = (*i)->file_->mtime_;
           if (input_mtime == 0) {
             restat_mtime = 0;
             break;
@@ -602,21 +910,35 @@ void Builder::FinishEdge(Edge* edge, bool success, const string& output) {
           if (input_mtime > restat_mtime)
             restat_mtime = input_mtime;
         }
+      }
 
-        // The total number of edges in the plan may have changed as a result
-        // of a restat.
+      // The total number of edges in the plan may have changed as a result
+      // of a restat.
+      if (node_cleaned)
         status_->PlanHasTotalEdges(plan_.command_edge_count());
-      }
+    } else if (!edge->is_phony() && !config_.dry_run) {
+      // The command rewrote its outputs; stat them again if a later
+      // restat needs their mtimes.
+      for (vector<Node*>::iterator i = edge->outputs_.begin();
+           i != edge->outputs_.end(); ++i)
+        (*i)->file_->mtime_ = -1;
     }
 
     plan_.EdgeFinished(edge);
+  } else {
+    plan_.EdgeFailed(edge);
   }
 
   if (edge->is_phony())
     return;
 
+  memory_budget_->CommandFinished(edge, usage.peak_rss_kb);
+  if (trace_)
+    trace_->CommandFinished(edge);
   int start_time, end_time;
   status_->BuildEdgeFinished(edge, success, output, &start_time, &end_time);
-  if (success && log_)
-    log_->RecordCommand(edge, start_time, end_time, restat_mtime);
+  // A dry run must not leave entries behind in a log that outlives it.
+  if (success && log_ && !config_.dry_run)
+    log_->RecordCommand(edge, start_time, end_time, restat_mtime,
+                        hashes.outputs.empty() ? 0 : hashes.inputs, &usage);
 }
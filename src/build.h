@@ -15,6 +15,8 @@
 #ifndef NINJA_BUILD_H_
 #define NINJA_BUILD_H_
 
+#include <stdint.h>
+
 #include <map>
 #include <set>
 #include <string>
@@ -23,13 +25,25 @@
 using namespace std;
 
 struct BuildLog;
+struct CommandOutput;
 struct Edge;
 struct DiskInterface;
+struct HashCache;
+struct MemoryBudget;
 struct Node;
+struct Pool;
+struct ResourceUsage;
 struct State;
+struct Throttle;
+struct Trace;
 
 /// Plan stores the state of a build plan: what we intend to build,
 /// which steps we're ready to execute.
+///
+/// Edges in a pool only become ready while fewer than the pool's depth
+/// of its edges are ready or running; the rest wait in the pool's queue,
+/// in the order their inputs became ready, without holding up edges in
+/// other pools.
 struct Plan {
   Plan();
 
@@ -40,7 +54,9 @@ struct Plan {
 
   // Pop a ready edge off the queue of edges to build.
   // Returns NULL if there's no work to do.
-  Edge* FindWork();
+  /// If \a budget is given and the next edge doesn't fit in it, returns
+  /// NULL and leaves the edge ready.
+  Edge* FindWork(MemoryBudget* budget = NULL);
 
   /// Returns true if there's more work to be done.
   bool more_to_do() const { return wanted_edges_; }
@@ -52,16 +68,28 @@ struct Plan {
   /// tests.
   void EdgeFinished(Edge* edge);
 
+  /// Mark an edge's command as failed, so that it no longer counts
+  /// against its pool.
+  void EdgeFailed(Edge* edge);
+
   /// Clean the given node during the build.
-  void CleanNode(BuildLog* build_log, Node* node);
+  void CleanNode(BuildLog* build_log, HashCache* hash_cache, Node* node);
 
   /// Number of edges with commands to run.
   int command_edge_count() const { return command_edges_; }
 
+  /// Append the outputs of the edges we want to build to \a outputs.
+  void WantedOutputs(vector<Node*>* outputs) const;
+
 private:
   bool AddSubTarget(Node* node, vector<Node*>* stack, string* err);
   bool CheckDependencyCycle(Node* node, vector<Node*>* stack, string* err);
   void NodeFinished(Node* node);
+  /// Make \a edge, whose inputs are ready, ready to run, or queue it if
+  /// its pool is full.  Does nothing if \a edge was already scheduled.
+  void ScheduleWork(Edge* edge);
+  /// Give \a edge's place in its pool to the next edge waiting.
+  void ReleasePool(Edge* edge);
 
   /// Keep track of which edges we want to build in this plan.  If this map does
   /// not contain an entry for an edge, we do not want to build the entry or its
@@ -72,6 +100,17 @@ private:
 
   set<Edge*> ready_;
 
+  /// The edges of a pool that are ready or running, and the edges
+  /// waiting for one of them to finish.
+  struct PoolQueue {
+    PoolQueue() : in_use(0) {}
+    int in_use;
+    queue<Edge*> waiting;
+  };
+  map<const Pool*, PoolQueue> pools_;
+  /// The edges passed to ScheduleWork() that haven't finished yet.
+  set<Edge*> scheduled_;
+
   /// Total number of edges that have commands (not phony).
   int command_edges_;
 
@@ -86,14 +125,19 @@ struct CommandRunner {
   virtual ~CommandRunner() {}
   virtual bool CanRunMore() = 0;
   virtual bool StartCommand(Edge* edge) = 0;
-  /// Wait for a command to complete.
-  virtual Edge* WaitForCommand(bool* success, string* output) = 0;
+  /// Wait for a command to complete, moving what it printed into
+  /// \a output and what it used into \a usage.  Returns NULL if
+  /// interrupted.
+  virtual Edge* WaitForCommand(bool* success, CommandOutput* output,
+                               ResourceUsage* usage) = 0;
 };
 
 /// Options (e.g. verbosity, parallelism) passed to a build.
 struct BuildConfig {
   BuildConfig() : verbosity(NORMAL), dry_run(false), parallelism(1),
-                  swallow_failures(0) {}
+                  swallow_failures(0), make_dirs_first(false),
+                  output_limit(1 << 20), max_load_average(0),
+                  max_pressure(0), memory_budget_kb(-1) {}
 
   enum Verbosity {
     NORMAL,
@@ -104,11 +148,27 @@ struct BuildConfig {
   bool dry_run;
   int parallelism;
   int swallow_failures;
+  /// Create the output directories of all planned edges before running
+  /// the first command, rather than as each edge starts.
+  bool make_dirs_first;
+  /// The amount of each command's output to keep in memory; the rest is
+  /// spilled to a temporary file until the command finishes.
+  size_t output_limit;
+  /// Run fewer commands while the load average is above
+  /// max_load_average, or the CPU, memory or IO pressure is above
+  /// max_pressure percent.  0 to not check.
+  double max_load_average;
+  double max_pressure;
+  /// Don't start a command if, by the build log, the commands running
+  /// would then need more than this much memory.  -1 for the memory
+  /// available when the build starts, 0 to not check.
+  int64_t memory_budget_kb;
 };
 
 /// Builder wraps the build process: starting commands, updating status.
 struct Builder {
   Builder(State* state, const BuildConfig& config);
+  ~Builder();
 
   Node* AddTarget(const string& name, string* err);
 
@@ -124,7 +184,16 @@ struct Builder {
   bool Build(string* err);
 
   bool StartEdge(Edge* edge, string* err);
-  void FinishEdge(Edge* edge, bool success, const string& output);
+  void FinishEdge(Edge* edge, bool success, const CommandOutput& output,
+                  const ResourceUsage& usage);
+
+  /// Stat the files and load the depfiles that the dirty scan of
+  /// \a target will need, a batch at a time, if the disk interface can
+  /// batch them.  Depfiles of edges already known to be dirty are left.
+  void Prefetch(Node* target);
+
+  /// Create the parent directories of \a node, if not known to exist.
+  bool MakeOutputDirs(Node* node, string* err);
 
   State* state_;
   const BuildConfig& config_;
@@ -132,7 +201,24 @@ struct Builder {
   DiskInterface* disk_interface_;
   CommandRunner* command_runner_;
   struct BuildStatus* status_;
+  /// Lowers the parallelism while the machine is saturated.
+  Throttle* throttle_;
+  /// Keeps the commands running within the memory budget.
+  MemoryBudget* memory_budget_;
   struct BuildLog* log_;
+  /// If set, where to record when commands ran.
+  Trace* trace_;
+
+  /// Directories found or created during this build.
+  set<string> known_dirs_;
+
+  /// Content hashes taken as an edge started, when using content hashes.
+  struct StartHashes {
+    StartHashes() : inputs(0) {}
+    uint64_t inputs;  // 0 if they couldn't be hashed.
+    vector<uint64_t> outputs;  // 0 for outputs that didn't exist.
+  };
+  map<Edge*, StartHashes> start_hashes_;
 };
 
 #endif  // NINJA_BUILD_H_
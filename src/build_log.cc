@@ -15,39 +15,553 @@
 #include "build_log.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "build.h"
 #include "graph.h"
+#include "hash_cache.h"
+#include "state.h"
+#include "subprocess.h"
 #include "util.h"
 
 // Implementation details:
 // Each run's log appends to the log file.
-// To load, we run through all log entries in series, throwing away
-// older runs.
-// Once the number of redundant entries exceeds a threshold, we write
-// out a new file and replace the existing one with it.
+// To load, we map the table written by the last recompaction, and run
+// through the entries appended since in series, throwing away older runs.
+// Once the number of redundant or appended entries exceeds a threshold,
+// we write out a new file and replace the existing one with it.
+//
+// Since v6 the log is binary.  It starts with a Header, followed by
+// record_count Records, bucket_count hash buckets (a uint32_t index + 1
+// of the Record for that output, or 0), and the string table the Records
+// point into; Records of outputs built by the same command share its
+// string.  Each command appended after that is an AppendedRecord
+// followed by its outputs, each preceded by a uint32_t length, and the
+// command itself.  (In v6 each output was appended separately, with the
+// command.)  v8 and v9 added fields to the end of Records and
+// AppendedRecords; they read as zero from older logs.  Numbers are in
+// host byte order; the log isn't meant to be moved between machines.
 
 namespace {
 
 const char kFileSignature[] = "# ninja log v%d\n";
-const int kCurrentVersion = 3;
+const int kCurrentVersion = 9;
+/// Logs up to this version are text.
+const int kLastTextVersion = 5;
+
+struct Header {
+  char signature[16];
+  uint32_t record_count;
+  uint32_t bucket_count;
+  uint64_t strings_size;
+};
+
+struct Record {
+  int32_t start_time;
+  int32_t end_time;
+  int64_t restat_mtime;
+  uint64_t input_hash;
+  uint64_t output_offset;
+  uint64_t command_offset;
+  uint32_t output_len;
+  uint32_t command_len;
+  // Since v8.
+  uint64_t peak_rss_kb;
+  // Since v9.
+  uint64_t user_time_ms;
+  uint64_t system_time_ms;
+  uint64_t voluntary_switches;
+  uint64_t involuntary_switches;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+};
+
+struct AppendedRecord {
+  int32_t start_time;
+  int32_t end_time;
+  int64_t restat_mtime;
+  uint64_t input_hash;
+  /// The length of the output in v6.
+  uint32_t output_count;
+  uint32_t command_len;
+  // Since v8.
+  uint64_t peak_rss_kb;
+  // Since v9.
+  uint64_t user_time_ms;
+  uint64_t system_time_ms;
+  uint64_t voluntary_switches;
+  uint64_t involuntary_switches;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+};
+
+/// The size of a Record in a log of \a version.
+size_t RecordSize(int version) {
+  if (version < 8)
+    return offsetof(Record, peak_rss_kb);
+  if (version < 9)
+    return offsetof(Record, user_time_ms);
+  return sizeof(Record);
+}
+
+/// The size of an AppendedRecord in a log of \a version.
+size_t AppendedRecordSize(int version) {
+  if (version < 8)
+    return offsetof(AppendedRecord, peak_rss_kb);
+  if (version < 9)
+    return offsetof(AppendedRecord, user_time_ms);
+  return sizeof(AppendedRecord);
+}
+
+/// Copy the resource usage fields, which records and ResourceUsage
+/// name alike, from \a from to \a to.
+template<typename From, typename To>
+void CopyUsage(const From& from, To* to) {
+  to->peak_rss_kb = from.peak_rss_kb;
+  to->user_time_ms = from.user_time_ms;
+  to->system_time_ms = from.system_time_ms;
+  to->voluntary_switches = from.voluntary_switches;
+  to->involuntary_switches = from.involuntary_switches;
+  to->read_bytes = from.read_bytes;
+  to->write_bytes = from.write_bytes;
+}
+
+const Header* GetHeader(const char* map) {
+  return (const Header*)map;
+}
+
+/// Copy Record \a index out of a table whose Records are \a record_size
+/// bytes, zeroing fields the table doesn't have.
+Record GetRecord(const char* map, size_t record_size, uint32_t index) {
+  Record record;
+  memset(&record, 0, sizeof(record));
+  memcpy(&record, map + sizeof(Header) + index * record_size,
+         min(record_size, sizeof(record)));
+  return record;
+}
+
+const uint32_t* GetBuckets(const char* map, size_t record_size) {
+  return (const uint32_t*)(map + sizeof(Header) +
+                           GetHeader(map)->record_count * record_size);
+}
+
+const char* GetStrings(const char* map, size_t record_size) {
+  return (const char*)(GetBuckets(map, record_size) +
+                       GetHeader(map)->bucket_count);
+}
+
+/// Offset of the first appended entry.
+uint64_t TableSize(const Header& header, size_t record_size) {
+  return sizeof(Header) + header.record_count * (uint64_t)record_size +
+      header.bucket_count * (uint64_t)sizeof(uint32_t) + header.strings_size;
+}
+
+bool WriteHeader(FILE* f, uint32_t record_count, uint32_t bucket_count,
+                 uint64_t strings_size) {
+  Header header;
+  memset(&header, 0, sizeof(header));
+  snprintf(header.signature, sizeof(header.signature), kFileSignature,
+           kCurrentVersion);
+  header.record_count = record_count;
+  header.bucket_count = bucket_count;
+  header.strings_size = strings_size;
+  return fwrite(&header, sizeof(header), 1, f) == 1;
+}
+
+/// Write \a entries as a table to \a f.
+bool WriteTable(FILE* f, const vector<const BuildLog::LogEntry*>& entries) {
+  vector<Record> records;
+  records.reserve(entries.size());
+  string strings;
+  // Entries usually share the command string of their edge, but identical
+  // commands are stored once regardless.
+  map<const string*, uint64_t> command_offsets;
+  hash_map<string, uint64_t> unique_commands;
+  uint32_t bucket_count = 1;
+  while (bucket_count < entries.size() * 2)
+    bucket_count *= 2;
+  vector<uint32_t> buckets(bucket_count);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const BuildLog::LogEntry& entry = *entries[i];
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.start_time = entry.start_time;
+    record.end_time = entry.end_time;
+    record.restat_mtime = entry.restat_mtime;
+    record.input_hash = entry.input_hash;
+    CopyUsage(entry.usage, &record);
+    record.output_offset = strings.size();
+    record.output_len = entry.output.size();
+    strings += entry.output;
+    map<const string*, uint64_t>::iterator c =
+        command_offsets.find(entry.command);
+    if (c == command_offsets.end()) {
+      pair<hash_map<string, uint64_t>::iterator, bool> u =
+          unique_commands.insert(make_pair(*entry.command, strings.size()));
+      if (u.second)
+        strings += *entry.command;
+      c = command_offsets.insert(make_pair(entry.command,
+                                           u.first->second)).first;
+    }
+    record.command_offset = c->second;
+    record.command_len = entry.command->size();
+    records.push_back(record);
+
+    uint32_t mask = bucket_count - 1;
+    uint32_t b = HashBytes(entry.output.data(), entry.output.size()) & mask;
+    while (buckets[b])
+      b = (b + 1) & mask;
+    buckets[b] = records.size();
+  }
+
+  return WriteHeader(f, records.size(), bucket_count, strings.size()) &&
+      (records.empty() ||
+       fwrite(&records[0], sizeof(Record), records.size(), f) ==
+           records.size()) &&
+      fwrite(&buckets[0], sizeof(uint32_t), bucket_count, f) == bucket_count &&
+      fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+}
+
+/// Add the paths of the outputs \a state builds to \a live.
+void CollectLiveOutputs(const State* state, set<string>* live) {
+  for (vector<Edge*>::const_iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    for (vector<Node*>::iterator out = (*e)->outputs_.begin();
+         out != (*e)->outputs_.end(); ++out)
+      live->insert((*out)->file_->path_);
+  }
+}
+
+/// Write a new log to \a path holding the table of the mapped log \a map
+/// (which may be NULL, and has Records of \a record_size bytes) updated
+/// with \a entries.  If \a live is given, entries for outputs not in it
+/// are left out.  On success returns the new log, opened for appending.
+FILE* WriteCompactedLog(const string& path, const char* map,
+                        size_t record_size, const BuildLog::Log& entries,
+                        const set<string>* live, string* err) {
+  vector<const BuildLog::LogEntry*> kept;
+  for (BuildLog::Log::const_iterator i = entries.begin(); i != entries.end();
+       ++i) {
+    if (!live || live->count(i->first))
+      kept.push_back(i->second);
+  }
+  vector<BuildLog::LogEntry> from_table;
+  std::map<uint64_t, string> table_commands;
+  if (map) {
+    const Header& header = *GetHeader(map);
+    const char* strings = GetStrings(map, record_size);
+    from_table.reserve(header.record_count);
+    for (uint32_t i = 0; i < header.record_count; ++i) {
+      Record record = GetRecord(map, record_size, i);
+      if (record.output_offset + record.output_len > header.strings_size ||
+          record.command_offset + record.command_len > header.strings_size)
+        continue;  // Corrupt.
+      string output(strings + record.output_offset, record.output_len);
+      if (entries.find(output.c_str()) != entries.end() ||
+          (live && !live->count(output)))
+        continue;
+      from_table.push_back(BuildLog::LogEntry());
+      BuildLog::LogEntry& entry = from_table.back();
+      entry.output.swap(output);
+      string& command = table_commands[record.command_offset];
+      if (command.empty())
+        command.assign(strings + record.command_offset, record.command_len);
+      entry.command = &command;
+      entry.start_time = record.start_time;
+      entry.end_time = record.end_time;
+      entry.restat_mtime = record.restat_mtime;
+      entry.input_hash = record.input_hash;
+      CopyUsage(record, &entry.usage);
+    }
+  }
+  for (size_t i = 0; i < from_table.size(); ++i)
+    kept.push_back(&from_table[i]);
+
+  string temp_path = path + ".recompact";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return NULL;
+  }
+  if (!WriteTable(f, kept)) {
+    *err = strerror(errno);
+    fclose(f);
+    return NULL;
+  }
+  if (fclose(f) != 0) {
+    *err = strerror(errno);
+    return NULL;
+  }
+
+  if (unlink(path.c_str()) < 0) {
+    *err = strerror(errno);
+    return NULL;
+  }
+  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+    *err = strerror(errno);
+    return NULL;
+  }
 
+  f = fopen(path.c_str(), "ab");
+  if (!f) {
+    *err = strerror(errno);
+    return NULL;
+  }
+  SetCloseOnExec(fileno(f));
+  return f;
 }
 
+}  // namespace
+
+#ifndef _WIN32
+/// Writes appended entries to the log on a thread of its own, so that
+/// finishing a command doesn't wait for the disk.  Entries queued while
+/// a write is in progress go out together in the next one.
+struct LogWriter {
+  explicit LogWriter(FILE* file);
+  ~LogWriter();
+
+  /// Have the thread recompact the log at \a path before it writes
+  /// anything, as Recompact() would.  \a map must stay mapped until the
+  /// thread is stopped.  What the thread needs of \a entries and \a state
+  /// is copied now, as the build goes on changing them.
+  void CompactFirst(const string& path, const char* map, size_t record_size,
+                    const BuildLog::Log& entries, const State* state);
+
+  /// Start the thread.  Returns false if it couldn't be started.
+  bool Start();
+
+  /// Queue \a data, first waiting for the queue to drain if it's full.
+  void Append(const string& data);
+
+  /// Wait for everything queued to be written.
+  void Flush();
+
+  /// Write everything queued and stop the thread.  Returns false if any
+  /// write failed.
+  bool Stop();
+
+  /// The log file, which is replaced by compaction.
+  FILE* file() const { return file_; }
+
+ private:
+  static void* Run(void* arg);
+
+  /// Do the compaction asked for by CompactFirst().
+  void Compact();
+
+  /// How many bytes may be queued before Append() waits.
+  static const size_t kMaxQueued = 4 << 20;
+
+  FILE* file_;
+  pthread_t thread_;
+  bool started_;
+  pthread_mutex_t mutex_;
+  /// Signaled when data is queued, or when it's time to stop.
+  pthread_cond_t queued_;
+  /// Signaled when a batch has been written.
+  pthread_cond_t written_;
+  string queue_;
+  bool writing_;
+  bool stopping_;
+  bool failed_;
+
+  bool compact_;
+  string compact_path_;
+  const char* compact_map_;
+  size_t compact_record_size_;
+  BuildLog::Log compact_entries_;
+  /// The commands of compact_entries_, by the BuildLog's string for each,
+  /// as the build may free those.
+  std::map<const string*, string*> compact_commands_;
+  /// The outputs still built, if there was a State to tell.
+  set<string> compact_live_;
+  bool compact_filter_;
+};
+
+LogWriter::LogWriter(FILE* file)
+    : file_(file), started_(false), writing_(false), stopping_(false),
+      failed_(false), compact_(false), compact_map_(NULL),
+      compact_record_size_(0), compact_filter_(false) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&queued_, NULL);
+  pthread_cond_init(&written_, NULL);
+}
+
+LogWriter::~LogWriter() {
+  Stop();
+  // Advancing an iterator may hash the key, which the entry owns.
+  for (BuildLog::Log::iterator i = compact_entries_.begin();
+       i != compact_entries_.end(); ) {
+    BuildLog::LogEntry* entry = i->second;
+    ++i;
+    delete entry;
+  }
+  for (std::map<const string*, string*>::iterator i =
+           compact_commands_.begin(); i != compact_commands_.end(); ++i)
+    delete i->second;
+  pthread_cond_destroy(&written_);
+  pthread_cond_destroy(&queued_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void LogWriter::CompactFirst(const string& path, const char* map,
+                             size_t record_size,
+                             const BuildLog::Log& entries,
+                             const State* state) {
+  compact_ = true;
+  compact_path_ = path;
+  compact_map_ = map;
+  compact_record_size_ = record_size;
+  compact_filter_ = state != NULL;
+  if (state)
+    CollectLiveOutputs(state, &compact_live_);
+  for (BuildLog::Log::const_iterator i = entries.begin(); i != entries.end();
+       ++i) {
+    BuildLog::LogEntry* entry = new BuildLog::LogEntry(*i->second);
+    string*& command = compact_commands_[entry->command];
+    if (!command)
+      command = new string(*entry->command);
+    entry->command = command;
+    compact_entries_.insert(make_pair(entry->output.c_str(), entry));
+  }
+}
+
+void LogWriter::Compact() {
+  string err;
+  FILE* f = WriteCompactedLog(compact_path_, compact_map_,
+                              compact_record_size_, compact_entries_,
+                              compact_filter_ ? &compact_live_ : NULL, &err);
+  if (f) {
+    fclose(file_);
+    file_ = f;
+  } else {
+    // Keep appending to the old log; a later run will try again.
+    Warning("recompacting build log: %s", err.c_str());
+  }
+  compact_ = false;
+}
+
+bool LogWriter::Start() {
+  // Leave the signals SubprocessSet handles to the main thread, where
+  // they interrupt the wait for commands.
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+  started_ = pthread_create(&thread_, NULL, Run, this) == 0;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return started_;
+}
+
+void LogWriter::Append(const string& data) {
+  pthread_mutex_lock(&mutex_);
+  while (queue_.size() >= kMaxQueued)
+    pthread_cond_wait(&written_, &mutex_);
+  queue_.append(data);
+  pthread_cond_signal(&queued_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+void LogWriter::Flush() {
+  pthread_mutex_lock(&mutex_);
+  while (!queue_.empty() || writing_)
+    pthread_cond_wait(&written_, &mutex_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+bool LogWriter::Stop() {
+  if (!started_)
+    return !failed_;
+  pthread_mutex_lock(&mutex_);
+  stopping_ = true;
+  pthread_cond_signal(&queued_);
+  pthread_mutex_unlock(&mutex_);
+  pthread_join(thread_, NULL);
+  started_ = false;
+  return !failed_;
+}
+
+void* LogWriter::Run(void* arg) {
+  LogWriter* writer = (LogWriter*)arg;
+  if (writer->compact_)
+    writer->Compact();
+
+  string batch;
+  pthread_mutex_lock(&writer->mutex_);
+  for (;;) {
+    while (writer->queue_.empty() && !writer->stopping_)
+      pthread_cond_wait(&writer->queued_, &writer->mutex_);
+    if (writer->queue_.empty())
+      break;  // Stopping, and everything's written.
+    batch.swap(writer->queue_);
+    writer->writing_ = true;
+    pthread_mutex_unlock(&writer->mutex_);
+
+    bool ok = fwrite(batch.data(), 1, batch.size(), writer->file_) ==
+        batch.size() && fflush(writer->file_) == 0;
+    batch.clear();
+
+    pthread_mutex_lock(&writer->mutex_);
+    writer->writing_ = false;
+    if (!ok)
+      writer->failed_ = true;
+    pthread_cond_broadcast(&writer->written_);
+  }
+  pthread_mutex_unlock(&writer->mutex_);
+  return NULL;
+}
+#endif  // _WIN32
+
 BuildLog::BuildLog()
-  : log_file_(NULL), config_(NULL), needs_recompaction_(false) {}
+  : log_file_(NULL), writer_(NULL), config_(NULL), state_(NULL),
+    needs_recompaction_(false), can_append_(true), map_(NULL),
+    record_size_(0), map_size_(0) {}
+
+BuildLog::~BuildLog() {
+  Close();
+  Unmap();
+  // Advancing an iterator may hash the key, which the entry owns.
+  for (Log::iterator i = log_.begin(); i != log_.end(); ) {
+    LogEntry* entry = i->second;
+    ++i;
+    delete entry;
+  }
+}
 
 bool BuildLog::OpenForWrite(const string& path, string* err) {
   if (config_ && config_->dry_run)
     return true;  // Do nothing, report success.
 
-  if (needs_recompaction_) {
+#ifndef _WIN32
+  // Logs we can go on appending to are recompacted by the writer thread
+  // while the build runs.
+  bool compact_now = needs_recompaction_ && !can_append_;
+#else
+  bool compact_now = needs_recompaction_;
+#endif
+  if (compact_now) {
     Close();
     if (!Recompact(path, err))
       return false;
+    needs_recompaction_ = false;
   }
 
   log_file_ = fopen(path.c_str(), "ab");
@@ -55,22 +569,39 @@ bool BuildLog::OpenForWrite(const string& path, string* err) {
     *err = strerror(errno);
     return false;
   }
-  setvbuf(log_file_, NULL, _IOLBF, BUFSIZ);
   SetCloseOnExec(fileno(log_file_));
 
   if (ftell(log_file_) == 0) {
-    if (fprintf(log_file_, kFileSignature, kCurrentVersion) < 0) {
+    // An empty table; everything is appended.
+    if (!WriteHeader(log_file_, 0, 0, 0) || fflush(log_file_) != 0) {
       *err = strerror(errno);
       return false;
     }
   }
 
+#ifndef _WIN32
+  // If the thread can't be started, write synchronously instead, and
+  // leave compaction to a later run.
+  writer_ = new LogWriter(log_file_);
+  if (needs_recompaction_)
+    writer_->CompactFirst(path, map_, record_size_, log_, state_);
+  if (writer_->Start()) {
+    needs_recompaction_ = false;
+  } else {
+    delete writer_;
+    writer_ = NULL;
+  }
+#endif
+
   return true;
 }
 
 void BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
-                             time_t restat_mtime) {
-  const string command = edge->EvaluateCommand();
+                             TimeStamp restat_mtime, uint64_t input_hash,
+                             const ResourceUsage* usage) {
+  string evaluated = edge->EvaluateCommand();
+  const string* command = AddCommand(evaluated.data(), evaluated.size());
+  vector<LogEntry*> entries;
   for (vector<Node*>::iterator out = edge->outputs_.begin();
        out != edge->outputs_.end(); ++out) {
     const string& path = (*out)->file_->path_;
@@ -83,24 +614,55 @@ void BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
       log_entry->output = path;
       log_.insert(make_pair(log_entry->output.c_str(), log_entry));
     }
-    log_entry->command = command;
+    SetCommand(log_entry, command);
     log_entry->start_time = start_time;
     log_entry->end_time = end_time;
     log_entry->restat_mtime = restat_mtime;
+    log_entry->input_hash = input_hash;
+    log_entry->usage = usage ? *usage : ResourceUsage();
+    (*out)->log_entry_ = log_entry;
+    (*out)->log_entry_source_ = this;
+    entries.push_back(log_entry);
+  }
 
-    if (log_file_)
-      WriteEntry(log_file_, *log_entry);
+  if (!log_file_)
+    return;
+  string data;
+  WriteEntries(entries, &data);
+#ifndef _WIN32
+  if (writer_) {
+    writer_->Append(data);
+    return;
   }
+#endif
+  fwrite(data.data(), 1, data.size(), log_file_);
+  fflush(log_file_);
+}
+
+void BuildLog::Flush() {
+#ifndef _WIN32
+  if (writer_)
+    writer_->Flush();
+#endif
 }
 
 void BuildLog::Close() {
+#ifndef _WIN32
+  if (writer_) {
+    if (!writer_->Stop())
+      Error("failed to write the build log");
+    log_file_ = writer_->file();
+    delete writer_;
+    writer_ = NULL;
+  }
+#endif
   if (log_file_)
     fclose(log_file_);
   log_file_ = NULL;
 }
 
 bool BuildLog::Load(const string& path, string* err) {
-  FILE* file = fopen(path.c_str(), "r");
+  FILE* file = fopen(path.c_str(), "rb");
   if (!file) {
     if (errno == ENOENT)
       return true;
@@ -113,6 +675,17 @@ bool BuildLog::Load(const string& path, string* err) {
   int total_entry_count = 0;
 
   char buf[256 << 10];
+  if (fgets(buf, sizeof(buf), file) &&
+      sscanf(buf, kFileSignature, &log_version) > 0 &&
+      log_version > kLastTextVersion) {
+    fclose(file);
+    return LoadBinary(path, log_version, err);
+  }
+  log_version = 0;
+  rewind(file);
+  // Text logs are rewritten in the binary format before appending.
+  can_append_ = false;
+
   while (fgets(buf, sizeof(buf), file)) {
     if (!log_version) {
       log_version = 1;  // Assume by default.
@@ -126,7 +699,8 @@ bool BuildLog::Load(const string& path, string* err) {
     *end = 0;
 
     int start_time = 0, end_time = 0;
-    time_t restat_mtime = 0;
+    TimeStamp restat_mtime = 0;
+    uint64_t input_hash = 0;
 
     if (log_version == 1) {
       // In v1 we logged how long the command took; we don't use this info.
@@ -146,12 +720,25 @@ bool BuildLog::Load(const string& path, string* err) {
     }
     
     if (log_version >= 3) {
-      // In v3 we log the restat mtime.
+      // In v3 we log the restat mtime, in seconds until v4 and in
+      // nanoseconds since.
       char* end = strchr(start, ' ');
       if (!end)
         continue;
       *end = 0;
-      restat_mtime = atol(start);
+      restat_mtime = strtoll(start, NULL, 10);
+      if (log_version < 4)
+        restat_mtime *= 1000000000LL;
+      start = end + 1;
+    }
+
+    if (log_version >= 5) {
+      // In v5 we log the hash of the inputs.
+      char* end = strchr(start, ' ');
+      if (!end)
+        continue;
+      *end = 0;
+      input_hash = strtoull(start, NULL, 16);
       start = end + 1;
     }
 
@@ -180,7 +767,8 @@ bool BuildLog::Load(const string& path, string* err) {
     entry->start_time = start_time;
     entry->end_time = end_time;
     entry->restat_mtime = restat_mtime;
-    entry->command = string(start, end - start);
+    entry->input_hash = input_hash;
+    SetCommand(entry, AddCommand(start, end - start));
   }
 
   // Decide whether it's time to rebuild the log:
@@ -200,48 +788,291 @@ bool BuildLog::Load(const string& path, string* err) {
   return true;
 }
 
-BuildLog::LogEntry* BuildLog::LookupByOutput(const string& path) {
-  Log::iterator i = log_.find(path.c_str());
-  if (i != log_.end())
-    return i->second;
-  return NULL;
+bool BuildLog::LoadBinary(const string& path, int log_version, string* err) {
+  Unmap();
+#ifdef _WIN32
+  if (::ReadFile(path, &map_buffer_, err) < 0)
+    return false;
+  map_ = map_buffer_.empty() ? NULL : &map_buffer_[0];
+  map_size_ = map_buffer_.size();
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    *err = strerror(errno);
+    close(fd);
+    return false;
+  }
+  map_size_ = st.st_size;
+  void* map = mmap(NULL, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    *err = strerror(errno);
+    map_size_ = 0;
+    return false;
+  }
+  map_ = (char*)map;
+#endif
+  record_size_ = RecordSize(log_version);
+
+  if (map_size_ < sizeof(Header) ||
+      map_size_ < TableSize(*GetHeader(map_), record_size_)) {
+    // Truncated; start over.
+    Unmap();
+    needs_recompaction_ = true;
+    can_append_ = false;
+    return true;
+  }
+  const Header& header = *GetHeader(map_);
+
+  // Read in the entries appended since the table was written.
+  int unique_entry_count = header.record_count;
+  int total_entry_count = header.record_count;
+  int appended_entry_count = 0;
+  size_t pos = TableSize(header, record_size_);
+  size_t appended_record_size = AppendedRecordSize(log_version);
+  vector<pair<const char*, uint32_t> > outputs;
+  while (pos < map_size_) {
+    AppendedRecord record;
+    memset(&record, 0, sizeof(record));
+    bool partial = map_size_ - pos < appended_record_size;
+    if (!partial) {
+      memcpy(&record, map_ + pos, appended_record_size);
+      pos += appended_record_size;
+    }
+
+    outputs.clear();
+    if (partial) {
+    } else if (log_version < 7) {
+      partial = map_size_ - pos < record.output_count;
+      if (!partial) {
+        outputs.push_back(make_pair(map_ + pos, record.output_count));
+        pos += record.output_count;
+      }
+    } else {
+      for (uint32_t n = 0; n < record.output_count && !partial; ++n) {
+        uint32_t len;
+        partial = map_size_ - pos < sizeof(len);
+        if (partial)
+          break;
+        memcpy(&len, map_ + pos, sizeof(len));
+        pos += sizeof(len);
+        partial = map_size_ - pos < len;
+        if (!partial) {
+          outputs.push_back(make_pair(map_ + pos, len));
+          pos += len;
+        }
+      }
+    }
+    if (partial || map_size_ - pos < record.command_len) {
+      // Drop the partial entry before appending after it.
+      needs_recompaction_ = true;
+      can_append_ = false;
+      break;
+    }
+    const string* command = AddCommand(map_ + pos, record.command_len);
+    pos += record.command_len;
+
+    for (size_t o = 0; o < outputs.size(); ++o) {
+      LogEntry* entry;
+      string output(outputs[o].first, outputs[o].second);
+      Log::iterator i = log_.find(output.c_str());
+      if (i != log_.end()) {
+        entry = i->second;
+      } else {
+        entry = new LogEntry;
+        entry->output = output;
+        log_.insert(make_pair(entry->output.c_str(), entry));
+        if (FindRecord(output.data(), output.size()) < 0)
+          ++unique_entry_count;
+      }
+      ++total_entry_count;
+      ++appended_entry_count;
+
+      entry->start_time = record.start_time;
+      entry->end_time = record.end_time;
+      entry->restat_mtime = record.restat_mtime;
+      entry->input_hash = record.input_hash;
+      CopyUsage(record, &entry->usage);
+      SetCommand(entry, command);
+    }
+  }
+
+  if (log_version < kCurrentVersion) {
+    needs_recompaction_ = true;
+    can_append_ = false;
+  }
+
+  // Besides growing large, a log whose appended entries have become a
+  // sizable fraction of it loads more slowly than it needs to.
+  int kMinCompactionEntryCount = 100;
+  int kCompactionRatio = 3;
+  int kAppendedRatio = 8;
+  if (total_entry_count > kMinCompactionEntryCount &&
+      (total_entry_count > unique_entry_count * kCompactionRatio ||
+       appended_entry_count * kAppendedRatio > unique_entry_count)) {
+    needs_recompaction_ = true;
+  }
+
+  return true;
 }
 
-void BuildLog::WriteEntry(FILE* f, const LogEntry& entry) {
-  fprintf(f, "%d %d %ld %s %s\n",
-          entry.start_time, entry.end_time, (long) entry.restat_mtime,
-          entry.output.c_str(), entry.command.c_str());
+int64_t BuildLog::FindRecord(const char* output, size_t len) const {
+  if (!map_)
+    return -1;
+  const Header& header = *GetHeader(map_);
+  if (!header.bucket_count)
+    return -1;
+  const uint32_t* buckets = GetBuckets(map_, record_size_);
+  const char* strings = GetStrings(map_, record_size_);
+  uint32_t mask = header.bucket_count - 1;
+  for (uint32_t b = HashBytes(output, len) & mask, n = 0;
+       n < header.bucket_count; b = (b + 1) & mask, ++n) {
+    uint32_t index = buckets[b];
+    if (!index || index > header.record_count)
+      return -1;
+    Record record = GetRecord(map_, record_size_, index - 1);
+    if (record.output_len == len &&
+        record.output_offset + len <= header.strings_size &&
+        memcmp(strings + record.output_offset, output, len) == 0)
+      return index - 1;
+  }
+  return -1;
 }
 
-bool BuildLog::Recompact(const string& path, string* err) {
-  printf("Recompacting log...\n");
+BuildLog::LogEntry* BuildLog::AddRecord(uint32_t index) {
+  const Header& header = *GetHeader(map_);
+  Record record = GetRecord(map_, record_size_, index);
+  const char* strings = GetStrings(map_, record_size_);
+  if (record.output_offset + record.output_len > header.strings_size ||
+      record.command_offset + record.command_len > header.strings_size)
+    return NULL;  // Corrupt.
 
-  string temp_path = path + ".recompact";
-  FILE* f = fopen(temp_path.c_str(), "wb");
-  if (!f) {
-    *err = strerror(errno);
-    return false;
+  LogEntry* entry = new LogEntry;
+  entry->output.assign(strings + record.output_offset, record.output_len);
+  const string*& command = table_commands_[record.command_offset];
+  if (!command) {
+    command = AddCommand(strings + record.command_offset, record.command_len);
+    RetainCommand(command);
   }
+  SetCommand(entry, command);
+  entry->start_time = record.start_time;
+  entry->end_time = record.end_time;
+  entry->restat_mtime = record.restat_mtime;
+  entry->input_hash = record.input_hash;
+  CopyUsage(record, &entry->usage);
+  log_.insert(make_pair(entry->output.c_str(), entry));
+  return entry;
+}
 
-  if (fprintf(f, kFileSignature, kCurrentVersion) < 0) {
-    *err = strerror(errno);
-    return false;
-  }
+const string* BuildLog::AddCommand(const char* command, size_t len) {
+  // Keys aren't moved by insertions, so entries can point at them.
+  return &commands_.insert(make_pair(string(command, len), 0)).first->first;
+}
+
+void BuildLog::SetCommand(LogEntry* entry, const string* command) {
+  RetainCommand(command);
+  if (entry->command)
+    ReleaseCommand(entry->command);
+  entry->command = command;
+}
+
+void BuildLog::RetainCommand(const string* command) {
+  ++commands_.find(*command)->second;
+}
+
+void BuildLog::ReleaseCommand(const string* command) {
+  Commands::iterator i = commands_.find(*command);
+  if (--i->second == 0)
+    commands_.erase(i);
+}
 
-  for (Log::iterator i = log_.begin(); i != log_.end(); ++i) {
-    WriteEntry(f, *i->second);
+void BuildLog::Unmap() {
+#ifndef _WIN32
+  if (map_)
+    munmap(map_, map_size_);
+#endif
+  map_ = NULL;
+  map_size_ = 0;
+  map_buffer_.clear();
+  for (map<uint64_t, const string*>::iterator i = table_commands_.begin();
+       i != table_commands_.end(); ++i)
+    ReleaseCommand(i->second);
+  table_commands_.clear();
+}
+
+void BuildLog::LoadTable() {
+  if (!map_)
+    return;
+  const Header& header = *GetHeader(map_);
+  const char* strings = GetStrings(map_, record_size_);
+  for (uint32_t i = 0; i < header.record_count; ++i) {
+    Record record = GetRecord(map_, record_size_, i);
+    if (record.output_offset + record.output_len > header.strings_size)
+      continue;  // Corrupt.
+    string output(strings + record.output_offset, record.output_len);
+    if (log_.find(output.c_str()) == log_.end())
+      AddRecord(i);
   }
+}
 
-  fclose(f);
-  if (unlink(path.c_str()) < 0) {
-    *err = strerror(errno);
-    return false;
+BuildLog::LogEntry* BuildLog::LookupByOutput(const string& path) {
+  Log::iterator i = log_.find(path.c_str());
+  if (i != log_.end())
+    return i->second;
+  int64_t index = FindRecord(path.data(), path.size());
+  if (index >= 0)
+    return AddRecord(index);
+  return NULL;
+}
+
+BuildLog::LogEntry* BuildLog::LookupByOutput(Node* node) {
+  if (node->log_entry_source_ != this) {
+    node->log_entry_ = LookupByOutput(node->file_->path_);
+    node->log_entry_source_ = this;
   }
+  return node->log_entry_;
+}
 
-  if (rename(temp_path.c_str(), path.c_str()) < 0) {
-    *err = strerror(errno);
-    return false;
+void BuildLog::WriteEntries(const vector<LogEntry*>& entries, string* out) {
+  if (entries.empty())
+    return;
+  const LogEntry& first = *entries[0];
+  AppendedRecord record;
+  memset(&record, 0, sizeof(record));
+  record.start_time = first.start_time;
+  record.end_time = first.end_time;
+  record.restat_mtime = first.restat_mtime;
+  record.input_hash = first.input_hash;
+  CopyUsage(first.usage, &record);
+  record.output_count = entries.size();
+  record.command_len = first.command->size();
+  out->append((const char*)&record, sizeof(record));
+  for (vector<LogEntry*>::const_iterator i = entries.begin();
+       i != entries.end(); ++i) {
+    uint32_t len = (*i)->output.size();
+    out->append((const char*)&len, sizeof(len));
+    out->append((*i)->output);
   }
+  out->append(*first.command);
+}
+
+bool BuildLog::Recompact(const string& path, string* err) {
+  printf("Recompacting log...\n");
 
+  set<string> live;
+  if (state_)
+    CollectLiveOutputs(state_, &live);
+  // The old table stays mapped for lookups.
+  FILE* f = WriteCompactedLog(path, map_, record_size_, log_,
+                              state_ ? &live : NULL, err);
+  if (!f)
+    return false;
+  fclose(f);
+  can_append_ = true;
   return true;
 }
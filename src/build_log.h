@@ -15,14 +15,23 @@
 #ifndef NINJA_BUILD_LOG_H_
 #define NINJA_BUILD_LOG_H_
 
+#include <stdint.h>
+#include <stdio.h>
+
 #include <map>
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "hash_map.h"
+#include "resource_usage.h"
+#include "timestamp.h"
 
 struct BuildConfig;
 struct Edge;
+struct LogWriter;
+struct Node;
+struct State;
 
 /// Store a log of every command ran for every build.
 /// It has a few uses:
@@ -32,48 +41,138 @@ struct Edge;
 /// 2) historical timing information
 /// 3) maybe we can generate some sort of build overview output
 ///    from it
+///
+/// The log is a binary file whose entries as of the last recompaction
+/// form a table with a hash index, which is mapped into memory and
+/// queried in place; entries recorded since are appended after it and
+/// are read into log_ on load.  Older text logs are still read, and are
+/// rewritten in the binary format by Recompact().
 struct BuildLog {
   BuildLog();
-  ~BuildLog() { Close(); }
+  ~BuildLog();
 
   void SetConfig(BuildConfig* config) { config_ = config; }
+  /// Entries for outputs that \a state doesn't build are dropped when the
+  /// log is recompacted.
+  void SetState(const State* state) { state_ = state; }
+  /// Open the log for appending.  A log that has merely grown too large
+  /// is recompacted in the background while the build runs.
   bool OpenForWrite(const string& path, string* err);
+  /// Record that \a edge's command ran, using \a usage if known.
   void RecordCommand(Edge* edge, int start_time, int end_time,
-                     time_t restat_mtime = 0);
+                     TimeStamp restat_mtime = 0, uint64_t input_hash = 0,
+                     const ResourceUsage* usage = NULL);
+  /// Wait for the entries recorded so far to reach the log file.
+  void Flush();
+  /// Write out the remaining entries and close the log file.
   void Close();
 
   /// Load the on-disk log.
   bool Load(const string& path, string* err);
 
   struct LogEntry {
+    LogEntry()
+        : command(NULL), start_time(0), end_time(0), restat_mtime(0),
+          input_hash(0) {}
+
     string output;
-    string command;
+    /// Shared by the entries with the same command, and owned by the
+    /// BuildLog; set it with SetCommand().
+    const string* command;
     int start_time;
     int end_time;
-    time_t restat_mtime;
+    TimeStamp restat_mtime;
+    /// Hash of the inputs' contents when the command ran, or 0 if they
+    /// weren't hashed.  See Edge::HashInputs().
+    uint64_t input_hash;
+    /// What the command used of the machine.
+    ResourceUsage usage;
 
     // Used by tests.
     bool operator==(const LogEntry& o) {
-      return output == o.output && command == o.command &&
+      return output == o.output && *command == *o.command &&
           start_time == o.start_time && end_time == o.end_time &&
-          restat_mtime == o.restat_mtime;
+          restat_mtime == o.restat_mtime && input_hash == o.input_hash &&
+          usage == o.usage;
     }
   };
 
-  /// Lookup a previously-run command by its output path.
+  /// Lookup a previously-run command by its output path.  Entries found
+  /// in the table are copied into log_ on first use.
   LogEntry* LookupByOutput(const string& path);
+  /// Lookup the entry for \a node, which is remembered on the node so
+  /// that later lookups needn't hash its path.
+  LogEntry* LookupByOutput(Node* node);
+
+  /// Copy every entry of the table into log_, for tools that examine the
+  /// whole log.
+  void LoadTable();
 
-  /// Serialize an entry into a log file.
-  void WriteEntry(FILE* f, const LogEntry& entry);
+  /// The number of distinct commands held.  Used by tests.
+  size_t command_count() const { return commands_.size(); }
 
-  /// Rewrite the known log entries, throwing away old data.
+  /// Serialize the entries for the outputs of one command, which share
+  /// the command, for appending to the log file into \a out.
+  void WriteEntries(const vector<LogEntry*>& entries, string* out);
+
+  /// Rewrite the known log entries, throwing away old data and the
+  /// entries of outputs that are no longer built.
   bool Recompact(const string& path, string* err);
 
   typedef ExternalStringHashMap<LogEntry*>::Type Log;
+  /// Entries recorded since the table was written, and entries copied
+  /// out of the table.
   Log log_;
   FILE* log_file_;
+  /// Writes to log_file_ in the background, if threads are available.
+  LogWriter* writer_;
   BuildConfig* config_;
+  const State* state_;
   bool needs_recompaction_;
+
+ private:
+  /// False if the log must be recompacted before entries are appended
+  /// to it, e.g. because it's a text log.
+  bool can_append_;
+
+  /// Load a binary log, after Load() has checked its signature.
+  bool LoadBinary(const string& path, int log_version, string* err);
+
+  /// Return a string holding \a command that entries can share.  It's
+  /// freed once nothing refers to it any more.
+  const string* AddCommand(const char* command, size_t len);
+  /// Point \a entry at \a command, which came from AddCommand(), and
+  /// release the command it had.
+  void SetCommand(LogEntry* entry, const string* command);
+  /// Take and drop a reference to \a command.
+  void RetainCommand(const string* command);
+  void ReleaseCommand(const string* command);
+
+  /// Find the table entry for \a output, or return -1.
+  int64_t FindRecord(const char* output, size_t len) const;
+
+  /// Copy table entry \a index into log_.
+  LogEntry* AddRecord(uint32_t index);
+
+  /// Release the mapped log file.
+  void Unmap();
+
+  /// The mapped log file, or NULL.
+  char* map_;
+  /// The size of its table's Records, which grew with new fields.
+  size_t record_size_;
+  size_t map_size_;
+  /// On Windows the log file is read into here rather than mapped.
+  string map_buffer_;
+
+  /// The commands of all entries, with how many entries (and
+  /// table_commands_) refer to each, so that a long-lived log doesn't
+  /// keep the commands no output was last built with.
+  typedef hash_map<string, int> Commands;
+  Commands commands_;
+  /// The commands copied out of the table so far, by offset.  Each holds
+  /// a reference until the table is unmapped.
+  map<uint64_t, const string*> table_commands_;
 };
 
 #endif // NINJA_BUILD_LOG_H_
@@ -14,7 +14,9 @@
 
 #include "build_log.h"
 
+#include "graph.h"
 #include "test.h"
+#include "util.h"
 
 #ifdef WIN32
 #include <fcntl.h>
@@ -78,7 +80,7 @@ TEST_F(BuildLogTest, DoubleEntry) {
 
   BuildLog::LogEntry* e = log.LookupByOutput("out");
   ASSERT_TRUE(e);
-  ASSERT_EQ("command def", e->command);
+  ASSERT_EQ("command def", *e->command);
 }
 
 TEST_F(BuildLogTest, Truncate) {
@@ -132,5 +134,393 @@ TEST_F(BuildLogTest, UpgradeV2) {
   ASSERT_EQ(123, e->start_time);
   ASSERT_EQ(456, e->end_time);
   ASSERT_EQ(0, e->restat_mtime);
-  ASSERT_EQ("command", e->command);
+  ASSERT_EQ("command", *e->command);
+}
+
+TEST_F(BuildLogTest, UpgradeV3) {
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v3\n");
+  fprintf(f, "123 456 789 out command\n");
+  fclose(f);
+
+  string err;
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  // v3 logged the restat mtime in seconds.
+  BuildLog::LogEntry* e = log.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  ASSERT_EQ(789000000000LL, e->restat_mtime);
+  ASSERT_EQ("command", *e->command);
+}
+
+TEST_F(BuildLogTest, Table) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n");
+
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log1.RecordCommand(state_.edges_[0], 15, 18);
+  log1.Close();
+  EXPECT_TRUE(log1.Recompact(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  log1.RecordCommand(state_.edges_[1], 20, 25, 789, 0xabc);
+  log1.Close();
+
+  // "out" is in the table and is only read when it's looked up; "mid" was
+  // appended after it.
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(log2.needs_recompaction_);
+  ASSERT_EQ(1u, log2.log_.size());
+  BuildLog::LogEntry* e = log2.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  ASSERT_TRUE(*e == *log1.LookupByOutput("out"));
+  ASSERT_EQ(2u, log2.log_.size());
+  e = log2.LookupByOutput("mid");
+  ASSERT_TRUE(e);
+  ASSERT_TRUE(*e == *log1.LookupByOutput("mid"));
+  ASSERT_EQ(789, e->restat_mtime);
+  ASSERT_EQ(0xabcu, e->input_hash);
+  EXPECT_FALSE(log2.LookupByOutput("in"));
+
+  // Recompacting puts both into the table.
+  EXPECT_TRUE(log2.Recompact(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog log3;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(0u, log3.log_.size());
+  ASSERT_TRUE(log3.LookupByOutput("out"));
+  ASSERT_TRUE(log3.LookupByOutput("mid"));
+
+  // Truncating the table loses it, but doesn't crash or report an error.
+  struct stat statbuf;
+  ASSERT_EQ(0, stat(kTestFilename, &statbuf));
+  for (off_t size = statbuf.st_size - 1; size > 0; --size) {
+#ifndef WIN32
+    ASSERT_EQ(0, truncate(kTestFilename, size));
+#else
+    int fh;
+    fh = _sopen(kTestFilename, _O_RDWR | _O_CREAT, _SH_DENYNO, _S_IREAD | _S_IWRITE);
+    ASSERT_EQ(0, _chsize(fh, size));
+    _close(fh);
+#endif
+
+    BuildLog log4;
+    EXPECT_TRUE(log4.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_FALSE(log4.LookupByOutput("out"));
+  }
+}
+
+TEST_F(BuildLogTest, UpgradeToBinary) {
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v5\n");
+  fprintf(f, "123 456 789 abc out command\n");
+  fclose(f);
+
+  string err;
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log.needs_recompaction_);
+  EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(log2.needs_recompaction_);
+  BuildLog::LogEntry* e = log2.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  ASSERT_TRUE(*e == *log.LookupByOutput("out"));
+  ASSERT_EQ(0xabcu, e->input_hash);
+  ASSERT_EQ("command", *e->command);
+}
+
+TEST_F(BuildLogTest, ResourceUsage) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n");
+
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ResourceUsage usage;
+  usage.peak_rss_kb = 20 << 20;
+  usage.user_time_ms = 1500;
+  usage.system_time_ms = 250;
+  usage.voluntary_switches = 40;
+  usage.involuntary_switches = 7;
+  usage.read_bytes = 1 << 20;
+  usage.write_bytes = 3 << 20;
+  log1.RecordCommand(state_.edges_[0], 15, 18, 0, 0, &usage);
+  log1.RecordCommand(state_.edges_[1], 20, 25);
+  log1.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ASSERT_TRUE(log2.LookupByOutput("out"));
+  EXPECT_TRUE(usage == log2.LookupByOutput("out")->usage);
+  EXPECT_TRUE(ResourceUsage() == log2.LookupByOutput("mid")->usage);
+
+  // It survives being moved into the table.
+  EXPECT_TRUE(log2.Recompact(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog log3;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ASSERT_TRUE(log3.LookupByOutput("out"));
+  EXPECT_TRUE(usage == log3.LookupByOutput("out")->usage);
+}
+
+TEST_F(BuildLogTest, UpgradeV7) {
+  // A v7 log, whose records are shorter: "out" in the table and "mid"
+  // appended after it.
+  struct {
+    char signature[16];
+    uint32_t record_count;
+    uint32_t bucket_count;
+    uint64_t strings_size;
+  } header = { "# ninja log v7\n", 1, 1, 10 };
+  struct {
+    int32_t start_time, end_time;
+    int64_t restat_mtime;
+    uint64_t input_hash, output_offset, command_offset;
+    uint32_t output_len, command_len;
+  } record = { 1, 2, 3, 4, 0, 3, 3, 7 };
+  uint32_t bucket = 1;
+  struct {
+    int32_t start_time, end_time;
+    int64_t restat_mtime;
+    uint64_t input_hash;
+    uint32_t output_count, command_len;
+  } appended = { 5, 6, 7, 8, 1, 8 };
+  uint32_t output_len = 3;
+  FILE* f = fopen(kTestFilename, "wb");
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(&record, sizeof(record), 1, f);
+  fwrite(&bucket, sizeof(bucket), 1, f);
+  fputs("outcommand", f);
+  fwrite(&appended, sizeof(appended), 1, f);
+  fwrite(&output_len, sizeof(output_len), 1, f);
+  fputs("midcommand2", f);
+  fclose(f);
+
+  string err;
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log.needs_recompaction_);
+  BuildLog::LogEntry* e = log.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(1, e->start_time);
+  EXPECT_EQ(4u, e->input_hash);
+  EXPECT_EQ("command", *e->command);
+  EXPECT_TRUE(ResourceUsage() == e->usage);
+  e = log.LookupByOutput("mid");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(5, e->start_time);
+  EXPECT_EQ(8u, e->input_hash);
+  EXPECT_EQ("command2", *e->command);
+  EXPECT_TRUE(ResourceUsage() == e->usage);
+
+  // Opening it for writing rewrites it as the current version.
+  EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log.Close();
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(log2.needs_recompaction_);
+  ASSERT_TRUE(log2.LookupByOutput("out"));
+  ASSERT_TRUE(*log2.LookupByOutput("out") == *log.LookupByOutput("out"));
+  ASSERT_TRUE(log2.LookupByOutput("mid"));
+  ASSERT_TRUE(*log2.LookupByOutput("mid") == *log.LookupByOutput("mid"));
+}
+
+TEST_F(BuildLogTest, ManyEntries) {
+  string manifest;
+  for (int i = 0; i < 1000; ++i) {
+    char buf[64];
+    sprintf(buf, "build out%d: cat in\n", i);
+    manifest += buf;
+  }
+  AssertParse(&state_, manifest.c_str());
+
+  // Everything queued for the writer is in the file once it's closed.
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  for (size_t i = 0; i < state_.edges_.size(); ++i)
+    log1.RecordCommand(state_.edges_[i], i, i + 1);
+  log1.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1000u, log2.log_.size());
+  BuildLog::LogEntry* e = log2.LookupByOutput("out999");
+  ASSERT_TRUE(e);
+  ASSERT_EQ(999, e->start_time);
+}
+
+TEST_F(BuildLogTest, RecompactDropsDeadEntries) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n");
+
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log1.RecordCommand(state_.edges_[0], 15, 18);
+  log1.RecordCommand(state_.edges_[1], 20, 25);
+  log1.Close();
+
+  // "mid" is no longer built.
+  State state;
+  AssertParse(&state,
+"rule cat\n"
+"  command = cat $in > $out\n"
+"build out: cat in\n");
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log2.SetState(&state);
+  EXPECT_TRUE(log2.Recompact(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  BuildLog log3;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log3.LookupByOutput("out"));
+  EXPECT_FALSE(log3.LookupByOutput("mid"));
+}
+
+TEST_F(BuildLogTest, RecompactInBackground) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n");
+
+  // Enough redundant entries to call for recompaction.
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  for (int i = 0; i < 200; ++i)
+    log1.RecordCommand(state_.edges_[i % 2], i, i + 1);
+  log1.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log2.needs_recompaction_);
+  EXPECT_TRUE(log2.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log2.RecordCommand(state_.edges_[0], 300, 301);
+  log2.Close();
+
+  // The table has the latest entries as of opening the log, and the
+  // entry recorded since was appended to it.
+  BuildLog log3;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(log3.needs_recompaction_);
+  ASSERT_EQ(1u, log3.log_.size());
+  BuildLog::LogEntry* e = log3.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  ASSERT_EQ(300, e->start_time);
+  e = log3.LookupByOutput("mid");
+  ASSERT_TRUE(e);
+  ASSERT_EQ(199, e->start_time);
+}
+
+TEST_F(BuildLogTest, FreesCommandsNoLongerUsed) {
+  AssertParse(&state_, "build out: cat in\n");
+  State changed;
+  AssertParse(&changed,
+"rule cat\n"
+"  command = cat $in > $out\n"
+"build out: cat other\n");
+
+  // A log kept across builds only holds the commands last used.
+  BuildLog log;
+  for (int i = 0; i < 10; ++i) {
+    log.RecordCommand(state_.edges_[0], i, i + 1);
+    EXPECT_EQ(1u, log.command_count());
+    log.RecordCommand(changed.edges_[0], i, i + 1);
+    EXPECT_EQ(1u, log.command_count());
+  }
+  EXPECT_EQ("cat other > out", *log.LookupByOutput("out")->command);
+}
+
+TEST_F(BuildLogTest, MultipleOutputsShareCommand) {
+  AssertParse(&state_,
+"build out1 out2 out3: cat in\n");
+
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log1.RecordCommand(state_.edges_[0], 15, 18);
+  log1.Close();
+
+  // The command is stored once, both appended and in the table.
+  for (int pass = 0; pass < 2; ++pass) {
+    BuildLog log2;
+    EXPECT_TRUE(log2.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    BuildLog::LogEntry* e1 = log2.LookupByOutput("out1");
+    BuildLog::LogEntry* e3 = log2.LookupByOutput("out3");
+    ASSERT_TRUE(e1);
+    ASSERT_TRUE(e3);
+    EXPECT_EQ("cat in > out1 out2 out3", *e1->command);
+    EXPECT_EQ(e1->command, e3->command);
+    ASSERT_TRUE(*e1 == *log1.LookupByOutput("out1"));
+
+    string contents;
+    ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+    size_t first = contents.find(*e1->command);
+    ASSERT_NE(string::npos, first);
+    EXPECT_EQ(string::npos, contents.find(*e1->command, first + 1));
+
+    EXPECT_TRUE(log2.Recompact(kTestFilename, &err));
+    ASSERT_EQ("", err);
+  }
+}
+
+TEST_F(BuildLogTest, LookupByNode) {
+  AssertParse(&state_,
+"build out: cat in\n"
+"build out2: cat in\n");
+  Node* out = state_.LookupNode("out");
+  Node* out2 = state_.LookupNode("out2");
+
+  BuildLog log;
+  log.RecordCommand(state_.edges_[0], 15, 18);
+  EXPECT_EQ(log.LookupByOutput("out"), log.LookupByOutput(out));
+  EXPECT_EQ(&log, out->log_entry_source_);
+
+  // A node without an entry gets one once its command is recorded.
+  EXPECT_FALSE(log.LookupByOutput(out2));
+  log.RecordCommand(state_.edges_[1], 20, 25);
+  ASSERT_TRUE(log.LookupByOutput(out2));
+  EXPECT_EQ(20, log.LookupByOutput(out2)->start_time);
+
+  // Another log's entries are looked up afresh.
+  BuildLog log2;
+  EXPECT_FALSE(log2.LookupByOutput(out));
+  EXPECT_EQ(&log2, out->log_entry_source_);
 }
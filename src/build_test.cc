@@ -16,6 +16,8 @@
 
 #include "build_log.h"
 #include "graph.h"
+#include "hash_cache.h"
+#include "memory_budget.h"
 #include "test.h"
 
 /// Fixture for tests involving Plan.
@@ -176,11 +178,147 @@ TEST_F(PlanTest, DependencyCycle) {
   ASSERT_EQ("dependency cycle: out -> mid -> in -> pre -> out", err);
 }
 
+TEST_F(PlanTest, PoolDepth) {
+  AssertParse(&state_,
+"pool link\n"
+"  depth = 2\n"
+"rule ld\n"
+"  command = ld $in -o $out\n"
+"  pool = link\n"
+"build out1: ld in\n"
+"build out2: ld in\n"
+"build out3: ld in\n"
+"build out4: cat in\n"
+"build all: phony out1 out2 out3 out4\n");
+  GetNode("out1")->dirty_ = true;
+  GetNode("out2")->dirty_ = true;
+  GetNode("out3")->dirty_ = true;
+  GetNode("out4")->dirty_ = true;
+  GetNode("all")->dirty_ = true;
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  // Two of the links and the edge outside the pool are ready.
+  set<Edge*> ready;
+  for (int i = 0; i < 3; ++i) {
+    Edge* edge = plan_.FindWork();
+    ASSERT_TRUE(edge);
+    ready.insert(edge);
+  }
+  ASSERT_FALSE(plan_.FindWork());
+  ASSERT_EQ(0u, ready.count(GetNode("out3")->in_edge_));
+
+  // A link finishing, even by failing, lets the third start.
+  plan_.EdgeFailed(GetNode("out1")->in_edge_);
+  Edge* edge = plan_.FindWork();
+  ASSERT_EQ(GetNode("out3")->in_edge_, edge);
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, PoolWithMultipleOutputInputs) {
+  AssertParse(&state_,
+"pool one\n"
+"  depth = 1\n"
+"rule ld\n"
+"  command = ld $in -o $out\n"
+"  pool = one\n"
+"build a b: cat in\n"
+"build out: ld a b\n"
+"build out2: ld in\n"
+"build all: phony out out2\n");
+  GetNode("a")->dirty_ = true;
+  GetNode("b")->dirty_ = true;
+  GetNode("out")->dirty_ = true;
+  GetNode("out2")->dirty_ = true;
+  GetNode("all")->dirty_ = true;
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  Edge* cat = edge->rule_->name_ == "cat" ? edge : plan_.FindWork();
+  Edge* out2 = edge == cat ? plan_.FindWork() : edge;
+  ASSERT_EQ(GetNode("a")->in_edge_, cat);
+  ASSERT_EQ(GetNode("out2")->in_edge_, out2);
+  ASSERT_FALSE(plan_.FindWork());
+
+  // Both of "out"'s inputs become ready at once, but it waits its turn
+  // only once.
+  plan_.EdgeFinished(cat);
+  ASSERT_FALSE(plan_.FindWork());
+  plan_.EdgeFinished(out2);
+  edge = plan_.FindWork();
+  ASSERT_EQ(GetNode("out")->in_edge_, edge);
+  ASSERT_FALSE(plan_.FindWork());
+  plan_.EdgeFinished(edge);
+
+  edge = plan_.FindWork();
+  ASSERT_EQ(GetNode("all")->in_edge_, edge);
+  plan_.EdgeFinished(edge);
+  ASSERT_FALSE(plan_.FindWork());
+  ASSERT_FALSE(plan_.more_to_do());
+}
+
+TEST_F(PlanTest, MemoryBudget) {
+  AssertParse(&state_,
+"build a: cat in\n"
+"build b: cat in\n"
+"build c: cat in\n"
+"build all: phony a b c\n");
+  GetNode("a")->dirty_ = true;
+  GetNode("b")->dirty_ = true;
+  GetNode("c")->dirty_ = true;
+  GetNode("all")->dirty_ = true;
+
+  BuildLog log;
+  ResourceUsage usage;
+  usage.peak_rss_kb = 600;
+  log.RecordCommand(GetNode("a")->in_edge_, 0, 1, 0, 0, &usage);
+  log.RecordCommand(GetNode("b")->in_edge_, 0, 1, 0, 0, &usage);
+  log.RecordCommand(GetNode("c")->in_edge_, 0, 1, 0, 0, &usage);
+  MemoryBudget budget(1000, &log);
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  Edge* edge = plan_.FindWork(&budget);
+  ASSERT_TRUE(edge);
+  budget.CommandStarted(edge);
+
+  // The next edge doesn't fit alongside the first, so it stays ready
+  // until the first finishes.
+  ASSERT_FALSE(plan_.FindWork(&budget));
+  budget.CommandFinished(edge, 600);
+  plan_.EdgeFinished(edge);
+
+  edge = plan_.FindWork(&budget);
+  ASSERT_TRUE(edge);
+  budget.CommandStarted(edge);
+  ASSERT_FALSE(plan_.FindWork(&budget));
+  budget.CommandFinished(edge, 600);
+  plan_.EdgeFinished(edge);
+
+  edge = plan_.FindWork(&budget);
+  ASSERT_TRUE(edge);
+  plan_.EdgeFinished(edge);
+  edge = plan_.FindWork(&budget);
+  ASSERT_EQ(GetNode("all")->in_edge_, edge);
+  plan_.EdgeFinished(edge);
+  ASSERT_FALSE(plan_.more_to_do());
+}
+
 struct BuildTest : public StateTestWithBuiltinRules,
                    public CommandRunner {
   BuildTest() : config_(MakeConfig()), builder_(&state_, config_), now_(1),
                 last_command_(NULL) {
     builder_.disk_interface_ = &fs_;
+    // The builder's own runner would hold SIGINT and SIGTERM blocked.
+    delete builder_.command_runner_;
     builder_.command_runner_ = this;
     AssertParse(&state_,
 "build cat1: cat in1\n"
@@ -191,13 +329,20 @@ struct BuildTest : public StateTestWithBuiltinRules,
     fs_.Create("in2", now_, "");
   }
 
+  ~BuildTest() {
+    // These belong to the test, not the builder.
+    builder_.disk_interface_ = NULL;
+    builder_.command_runner_ = NULL;
+  }
+
   // Mark a path dirty.
   void Dirty(const string& path);
 
   // CommandRunner impl
   virtual bool CanRunMore();
   virtual bool StartCommand(Edge* edge);
-  virtual Edge* WaitForCommand(bool* success, string* output);
+  virtual Edge* WaitForCommand(bool* success, CommandOutput* output,
+                               ResourceUsage* usage);
 
   BuildConfig MakeConfig() {
     BuildConfig config;
@@ -251,7 +396,8 @@ bool BuildTest::StartCommand(Edge* edge) {
   return true;
 }
 
-Edge* BuildTest::WaitForCommand(bool* success, string* output) {
+Edge* BuildTest::WaitForCommand(bool* success, CommandOutput* output,
+                                ResourceUsage* usage) {
   if (Edge* edge = last_command_) {
     if (edge->rule_->name_ == "fail")
       *success = false;
@@ -420,6 +566,26 @@ TEST_F(BuildTest, MakeDirs) {
 #endif
 }
 
+TEST_F(BuildTest, MakeDirsFirst) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule fail\n"
+"  command = fail\n"
+"build dir1/out: fail in1\n"
+"build dir2/out: cat dir1/out\n"));
+
+  config_.make_dirs_first = true;
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("dir2/out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.Build(&err));
+  ASSERT_EQ(1u, commands_ran_.size());
+
+  // The directory for dir2/out was made even though its edge never ran.
+  ASSERT_EQ(2u, fs_.directories_made_.size());
+  EXPECT_EQ("dir1", fs_.directories_made_[0]);
+  EXPECT_EQ("dir2", fs_.directories_made_[1]);
+}
+
 TEST_F(BuildTest, DepFileMissing) {
   string err;
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
@@ -459,6 +625,79 @@ TEST_F(BuildTest, DepFileOK) {
   ASSERT_EQ("cc foo.c", edge->EvaluateCommand());
 }
 
+/// Records the batches passed to Prefetch().
+struct PrefetchRecorder : public VirtualFileSystem {
+  virtual bool CanPrefetch() { return true; }
+  virtual void Prefetch(const vector<string>& stat_paths,
+                        const vector<string>& read_paths) {
+    stat_batches_.push_back(stat_paths);
+    read_batches_.push_back(read_paths);
+  }
+  vector<vector<string> > stat_batches_;
+  vector<vector<string> > read_batches_;
+};
+
+TEST_F(BuildTest, PrefetchInRounds) {
+  PrefetchRecorder fs;
+  builder_.disk_interface_ = &fs;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n  command = cc $in\n  depfile = $out.d\n"
+"build foo.o: cc foo.c\n"));
+  fs.Create("foo.c", now_, "");
+  fs.Create("foo.o", now_, "");
+  fs.Create("blah.h", now_, "");
+  fs.Create("foo.o.d", now_, "foo.o: blah.h\n");
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("foo.o", &err));
+  ASSERT_EQ("", err);
+
+  // The first round has the files named in the manifest, the second the
+  // depfile of the edge they show to be clean so far, the third the deps
+  // named by the depfile.
+  ASSERT_EQ(3u, fs.stat_batches_.size());
+  ASSERT_EQ(2u, fs.stat_batches_[0].size());
+  EXPECT_EQ("foo.o", fs.stat_batches_[0][0]);
+  EXPECT_EQ("foo.c", fs.stat_batches_[0][1]);
+  EXPECT_EQ(0u, fs.read_batches_[0].size());
+  EXPECT_EQ(0u, fs.stat_batches_[1].size());
+  ASSERT_EQ(1u, fs.read_batches_[1].size());
+  EXPECT_EQ("foo.o.d", fs.read_batches_[1][0]);
+  ASSERT_EQ(1u, fs.stat_batches_[2].size());
+  EXPECT_EQ("blah.h", fs.stat_batches_[2][0]);
+  EXPECT_EQ(0u, fs.read_batches_[2].size());
+
+  // The depfile was only read once, by the prefetch.
+  ASSERT_EQ(1u, fs.files_read_.size());
+  EXPECT_FALSE(state_.edges_.back()->depfile_loaded_);
+}
+
+TEST_F(BuildTest, PrefetchSkipsDepfileOfDirtyEdge) {
+  PrefetchRecorder fs;
+  builder_.disk_interface_ = &fs;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n  command = cc $in\n  depfile = $out.d\n"
+"build foo.o: cc foo.c\n"));
+  fs.Create("foo.o", now_, "");
+  fs.Create("foo.c", now_ + 1, "");
+  fs.Create("blah.h", now_, "");
+  fs.Create("foo.o.d", now_, "foo.o: blah.h\n");
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("foo.o", &err));
+  ASSERT_EQ("", err);
+
+  // foo.o is older than foo.c, so its depfile isn't needed to know it's
+  // dirty: the prefetch doesn't read it, and its deps aren't stat()ed.
+  ASSERT_EQ(1u, fs.stat_batches_.size());
+  EXPECT_EQ(0u, fs.read_batches_[0].size());
+  EXPECT_FALSE(GetNode("blah.h")->file_->status_known());
+
+  // Only the scan read the depfile.
+  ASSERT_EQ(1u, fs.files_read_.size());
+  EXPECT_EQ("foo.o.d", fs.files_read_[0]);
+}
+
 TEST_F(BuildTest, DepFileParseError) {
   string err;
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
@@ -725,3 +964,76 @@ TEST_F(BuildWithLogTest, RestatTest) {
   EXPECT_TRUE(builder_.Build(&err));
   ASSERT_EQ(2u, commands_ran_.size());
 }
+
+TEST_F(BuildWithLogTest, RestatUsesScannedMtimes) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule true\n"
+"  command = true\n"
+"  restat = 1\n"
+"build gen: cat src\n"
+"build out: true in gen\n"));
+
+  fs_.Create("out", now_, "");
+  now_++;
+  fs_.Create("in", now_, "");
+  fs_.Create("src", now_, "");
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(2u, commands_ran_.size());
+
+  // "in" was only stat()ed by the scan; "gen" was stat()ed again after
+  // "cat" rewrote it.
+  EXPECT_EQ(1, count(fs_.files_statted_.begin(), fs_.files_statted_.end(),
+                     "in"));
+  EXPECT_EQ(2, count(fs_.files_statted_.begin(), fs_.files_statted_.end(),
+                     "gen"));
+  BuildLog::LogEntry* entry = build_log_.LookupByOutput("out");
+  ASSERT_TRUE(entry);
+  EXPECT_EQ(now_, entry->restat_mtime);
+}
+
+TEST_F(BuildWithLogTest, ContentHash) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out1: cat in\n"
+"build out2: cat out1\n"));
+  HashCache hash_cache(&fs_);
+  state_.hash_cache_ = &hash_cache;
+
+  fs_.Create("in", now_, "contents");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(2u, commands_ran_.size());
+
+  // Touching "in" without changing it should not rebuild anything.
+  now_++;
+  fs_.Create("in", now_, "contents");
+  commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+
+  // Changing "in" rebuilds out1, but since the "cat" in our tests always
+  // writes the same (empty) output, out2 is cut off.
+  now_++;
+  fs_.Create("in", now_, "new contents");
+  commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ(1u, commands_ran_.size());
+  EXPECT_EQ("cat in > out1", commands_ran_[0]);
+
+  // And that's remembered for the next run.
+  commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+}
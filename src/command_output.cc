@@ -0,0 +1,83 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "command_output.h"
+
+#include <errno.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "util.h"
+
+CommandOutput::CommandOutput() : spill_(NULL) {}
+
+CommandOutput::~CommandOutput() {
+  if (spill_)
+    fclose(spill_);
+}
+
+void CommandOutput::Append(const char* data, size_t len, size_t limit) {
+  if (!spill_ && text_.size() + len > limit) {
+    // If no temporary file can be made, keep everything in memory.
+    spill_ = tmpfile();
+  }
+  if (!spill_) {
+    text_.append(data, len);
+    return;
+  }
+
+  // The spill file is only written with write(), so that SpillFd() can
+  // be used alongside it.
+  int fd = SpillFd();
+  while (len > 0) {
+    int ret = write(fd, data, len);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      Fatal("write: %s", strerror(errno));
+    }
+    data += ret;
+    len -= ret;
+  }
+}
+
+int CommandOutput::SpillFd() const {
+  return fileno(spill_);
+}
+
+void CommandOutput::Print(FILE* out) const {
+  fwrite(text_.data(), 1, text_.size(), out);
+  if (!spill_)
+    return;
+
+  int fd = SpillFd();
+  off_t end = lseek(fd, 0, SEEK_CUR);
+  lseek(fd, 0, SEEK_SET);
+  char buf[64 << 10];
+  int len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    fwrite(buf, 1, len, out);
+  lseek(fd, end, SEEK_SET);
+}
+
+void CommandOutput::Swap(CommandOutput* other) {
+  text_.swap(other->text_);
+  FILE* spill = spill_;
+  spill_ = other->spill_;
+  other->spill_ = spill;
+}
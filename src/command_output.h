@@ -0,0 +1,61 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_COMMAND_OUTPUT_H_
+#define NINJA_COMMAND_OUTPUT_H_
+
+#include <stdio.h>
+
+#include <string>
+using namespace std;
+
+/// CommandOutput collects what a command prints.  Up to a limit it is
+/// kept in memory; past that it goes to an unlinked temporary file, so
+/// commands that write hundreds of megabytes of logs don't hold them all
+/// in ninja's memory until they finish.
+struct CommandOutput {
+  CommandOutput();
+  ~CommandOutput();
+
+  /// Add \a len bytes from \a data, spilling them to disk if more than
+  /// \a limit bytes would be in memory.
+  void Append(const char* data, size_t len, size_t limit);
+
+  /// Whether output has spilled to disk.  Once it has, the rest of the
+  /// output can also be written straight to SpillFd().
+  bool spilled() const { return spill_ != NULL; }
+  /// The file descriptor of the spill file, positioned at its end.
+  int SpillFd() const;
+
+  bool empty() const { return text_.empty() && !spill_; }
+  /// The output kept in memory: all of it, unless it spilled.
+  const string& text() const { return text_; }
+
+  /// Write all of the output to \a out.
+  void Print(FILE* out) const;
+
+  /// Exchange contents with \a other, without copying them.
+  void Swap(CommandOutput* other);
+
+ private:
+  string text_;
+  /// The output past text_, if any.
+  FILE* spill_;
+
+  // Not copyable; the spill file is owned.
+  CommandOutput(const CommandOutput&);
+  void operator=(const CommandOutput&);
+};
+
+#endif  // NINJA_COMMAND_OUTPUT_H_
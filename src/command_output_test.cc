@@ -0,0 +1,82 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "command_output.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Everything \a output prints.
+string Printed(const CommandOutput& output) {
+  FILE* f = tmpfile();
+  output.Print(f);
+  rewind(f);
+  string contents;
+  char buf[1024];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    contents.append(buf, len);
+  fclose(f);
+  return contents;
+}
+
+}  // namespace
+
+TEST(CommandOutput, InMemory) {
+  CommandOutput output;
+  EXPECT_TRUE(output.empty());
+  output.Append("hello ", 6, 100);
+  output.Append("world\n", 6, 100);
+  EXPECT_FALSE(output.spilled());
+  EXPECT_EQ("hello world\n", output.text());
+  EXPECT_EQ("hello world\n", Printed(output));
+}
+
+TEST(CommandOutput, Spill) {
+  CommandOutput output;
+  output.Append("hello ", 6, 10);
+  // Past the limit, output goes to disk and memory use stays put.
+  output.Append("world\n", 6, 10);
+  ASSERT_TRUE(output.spilled());
+  EXPECT_FALSE(output.empty());
+  EXPECT_EQ("hello ", output.text());
+  output.Append("again\n", 6, 10);
+  EXPECT_EQ("hello ", output.text());
+  EXPECT_EQ("hello world\nagain\n", Printed(output));
+  // Printing again gives the same, and appending carries on at the end.
+  EXPECT_EQ("hello world\nagain\n", Printed(output));
+  output.Append("!", 1, 10);
+  EXPECT_EQ("hello world\nagain\n!", Printed(output));
+}
+
+TEST(CommandOutput, SpillEverything) {
+  CommandOutput output;
+  output.Append("hi\n", 3, 0);
+  ASSERT_TRUE(output.spilled());
+  EXPECT_FALSE(output.empty());
+  EXPECT_EQ("", output.text());
+  EXPECT_EQ("hi\n", Printed(output));
+}
+
+TEST(CommandOutput, Swap) {
+  CommandOutput a, b;
+  a.Append("spilled", 7, 0);
+  b.Append("kept", 4, 100);
+  a.Swap(&b);
+  EXPECT_FALSE(a.spilled());
+  EXPECT_EQ("kept", Printed(a));
+  EXPECT_TRUE(b.spilled());
+  EXPECT_EQ("spilled", Printed(b));
+}
@@ -19,10 +19,31 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#ifdef linux
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "util.h"
+#ifdef linux
+#include "uring.h"
+#endif
 
 namespace {
 
+/// Convert the modification time in \a st to a TimeStamp.
+TimeStamp MTime(const struct stat& st) {
+#if defined(__APPLE__)
+  return (TimeStamp)st.st_mtimespec.tv_sec * 1000000000LL +
+      st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  return (TimeStamp)st.st_mtime * 1000000000LL;
+#else
+  return (TimeStamp)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+
 std::string DirName(const std::string& path) {
 #ifdef WIN32
   const char kPathSeparator = '\\';
@@ -42,26 +63,168 @@ std::string DirName(const std::string& path) {
 
 // DiskInterface ---------------------------------------------------------------
 
-bool DiskInterface::MakeDirs(const std::string& path) {
+bool DiskInterface::StatIdentity(const std::string& path,
+                                 FileIdentity* identity) {
+  *identity = FileIdentity();
+  identity->mtime = Stat(path);
+  return identity->mtime >= 0;
+}
+
+bool DiskInterface::MakeDirs(const std::string& path,
+                             std::set<std::string>* known) {
   std::string dir = DirName(path);
   if (dir.empty())
     return true;  // Reached root; assume it's there.
-  int mtime = Stat(dir);
+  if (known && known->count(dir))
+    return true;  // Found or created earlier.
+  TimeStamp mtime = Stat(dir);
   if (mtime < 0)
     return false;  // Error.
-  if (mtime > 0)
-    return true;  // Exists already; we're done.
+  if (mtime == 0) {
+    // Directory doesn't exist.  Try creating its parent first.
+    if (!MakeDirs(dir, known))
+      return false;
+    if (!MakeDir(dir))
+      return false;
+  }
+  if (known)
+    known->insert(dir);
+  return true;
+}
+
+// RealDiskInterface -----------------------------------------------------------
+
+RealDiskInterface::~RealDiskInterface() {
+#ifdef linux
+  delete uring_;
+#endif
+}
+
+TimeStamp RealDiskInterface::Stat(const std::string& path) {
+#ifdef linux
+  if (!use_cache_)
+    return StatUncached(path);
+
+  hash_map<std::string, TimeStamp>::iterator prefetched =
+      prefetched_mtimes_.find(path);
+  if (prefetched != prefetched_mtimes_.end())
+    return prefetched->second;
+
+  std::string dir, base;
+  std::string::size_type slash_pos = path.rfind('/');
+  if (slash_pos == std::string::npos) {
+    dir = ".";
+    base = path;
+  } else {
+    dir = DirName(path);
+    base = path.substr(slash_pos + 1);
+    if (dir.empty())
+      dir = "/";
+  }
+  if (base.empty())
+    return StatUncached(path);
+
+  Cache::iterator i = cache_.find(dir);
+  if (i == cache_.end()) {
+    DirCache listing;
+    if (!ListDir(dir, &listing))
+      return StatUncached(path);
+    i = cache_.insert(make_pair(dir, listing)).first;
+  }
+
+  DirCache::iterator entry = i->second.find(base);
+  if (entry == i->second.end())
+    return 0;
+  return entry->second;
+#else
+  return StatUncached(path);
+#endif
+}
+
+void RealDiskInterface::AllowStatCache(bool allow) {
+  use_cache_ = allow;
+  if (!use_cache_) {
+    cache_.clear();
+    prefetched_mtimes_.clear();
+    prefetched_files_.clear();
+  }
+}
 
-  // Directory doesn't exist.  Try creating its parent first.
-  bool success = MakeDirs(dir);
-  if (!success)
+bool RealDiskInterface::CanPrefetch() {
+#ifdef linux
+  if (!use_cache_ || uring_unavailable_)
     return false;
-  return MakeDir(dir);
+  if (!uring_) {
+    uring_ = new Uring;
+    if (!uring_->Init()) {
+      // Fall back to answering each call synchronously.
+      delete uring_;
+      uring_ = NULL;
+      uring_unavailable_ = true;
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
 }
 
-// RealDiskInterface -----------------------------------------------------------
+void RealDiskInterface::Prefetch(const std::vector<std::string>& stat_paths,
+                                 const std::vector<std::string>& read_paths) {
+#ifdef linux
+  if (!CanPrefetch())
+    return;
+
+  // Failures are left out, so that the synchronous path reports them.
+  std::vector<TimeStamp> mtimes;
+  uring_->Stat(stat_paths, &mtimes);
+  for (size_t i = 0; i < stat_paths.size(); ++i) {
+    if (mtimes[i] >= 0)
+      prefetched_mtimes_[stat_paths[i]] = mtimes[i];
+  }
+
+  std::vector<std::string> contents;
+  std::vector<bool> ok;
+  uring_->Read(read_paths, &contents, &ok);
+  for (size_t i = 0; i < read_paths.size(); ++i) {
+    if (ok[i])
+      prefetched_files_[read_paths[i]].swap(contents[i]);
+  }
+#endif
+}
 
-int RealDiskInterface::Stat(const std::string& path) {
+bool RealDiskInterface::ListDir(const std::string& dir, DirCache* listing) {
+#ifdef linux
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    // A missing directory is cached as an empty listing, so that lookups
+    // of e.g. headers in nonexistent directories don't hit the disk again.
+    return errno == ENOENT;
+  }
+  DIR* d = fdopendir(fd);
+  if (!d) {
+    close(fd);
+    return false;
+  }
+
+  struct dirent* ent;
+  while ((ent = readdir(d)) != NULL) {
+    struct stat st;
+    // Stat relative to the directory so the kernel doesn't walk the full
+    // path for every entry.
+    if (fstatat(fd, ent->d_name, &st, 0) < 0)
+      continue;  // E.g. a dangling symlink; it's as good as missing.
+    (*listing)[ent->d_name] = MTime(st);
+  }
+  closedir(d);
+  return true;
+#else
+  return false;
+#endif
+}
+
+TimeStamp RealDiskInterface::StatUncached(const std::string& path) {
   struct stat st;
   if (stat(path.c_str(), &st) < 0) {
     if (errno == ENOENT) {
@@ -72,7 +235,22 @@ int RealDiskInterface::Stat(const std::string& path) {
     }
   }
 
-  return st.st_mtime;
+  return MTime(st);
+}
+
+bool RealDiskInterface::StatIdentity(const std::string& path,
+                                     FileIdentity* identity) {
+  *identity = FileIdentity();
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    if (errno == ENOENT)
+      return true;
+    Error("stat(%s): %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  identity->inode = st.st_ino;
+  identity->size = st.st_size;
+  identity->mtime = MTime(st);
   return true;
 }
 
@@ -87,6 +265,14 @@ bool RealDiskInterface::MakeDir(const std::string& path) {
 std::string RealDiskInterface::ReadFile(const std::string& path,
                                         std::string* err) {
   std::string contents;
+  hash_map<std::string, std::string>::iterator prefetched =
+      prefetched_files_.find(path);
+  if (prefetched != prefetched_files_.end()) {
+    contents.swap(prefetched->second);
+    prefetched_files_.erase(prefetched);
+    return contents;
+  }
+
   int ret = ::ReadFile(path, &contents, err);
   if (ret == -ENOENT) {
     // Swallow ENOENT.
@@ -15,7 +15,27 @@
 #ifndef NINJA_DISK_INTERFACE_H_
 #define NINJA_DISK_INTERFACE_H_
 
+#include <set>
 #include <string>
+#include <vector>
+
+#include "hash_map.h"
+#include "timestamp.h"
+
+/// What identifies one version of a file without reading it: if the
+/// contents change, so does at least one of these fields.
+struct FileIdentity {
+  FileIdentity() : inode(0), size(-1), mtime(0) {}
+
+  bool operator==(const FileIdentity& o) const {
+    return inode == o.inode && size == o.size && mtime == o.mtime;
+  }
+  bool operator!=(const FileIdentity& o) const { return !(*this == o); }
+
+  uint64_t inode;
+  int64_t size;  // -1 if unknown.
+  TimeStamp mtime;  // 0 if the file is missing.
+};
 
 /// Interface for accessing the disk.
 ///
@@ -26,7 +46,12 @@ struct DiskInterface {
 
   /// stat() a file, returning the mtime, or 0 if missing and -1 on
   /// other errors.
-  virtual int Stat(const std::string& path) = 0;
+  virtual TimeStamp Stat(const std::string& path) = 0;
+
+  /// Fill in \a identity for the file at \a path, returning false on
+  /// errors other than the file missing.  The default implementation
+  /// only knows about mtimes.
+  virtual bool StatIdentity(const std::string& path, FileIdentity* identity);
 
   /// Create a directory, returning false on failure.
   virtual bool MakeDir(const std::string& path) = 0;
@@ -41,18 +66,70 @@ struct DiskInterface {
   ///          -1 if an error occurs.
   virtual int RemoveFile(const std::string& path) = 0;
 
+  /// Allow Stat() to answer from cached directory listings.  Callers must
+  /// disallow it again before anything (e.g. a build command) may modify
+  /// the files being stat()ed.  Implementations are free to ignore this.
+  virtual void AllowStatCache(bool allow) {}
+
+  /// Whether Prefetch() can batch its work now.  If not, callers needn't
+  /// gather any.
+  virtual bool CanPrefetch() { return false; }
+
+  /// Hint that \a stat_paths are about to be stat()ed and \a read_paths
+  /// read, while the stat cache is allowed.  Implementations may do the
+  /// work in batches and answer the following Stat() and ReadFile() calls
+  /// from the results.
+  virtual void Prefetch(const std::vector<std::string>& stat_paths,
+                        const std::vector<std::string>& read_paths) {}
+
   /// Create all the parent directories for path; like mkdir -p
-  /// `basename path`.
-  bool MakeDirs(const std::string& path);
+  /// `basename path`.  If \a known is non-NULL, directories in it are
+  /// assumed to exist, and directories found or created are added to it.
+  bool MakeDirs(const std::string& path, std::set<std::string>* known = NULL);
 };
 
 /// Implementation of DiskInterface that actually hits the disk.
 struct RealDiskInterface : public DiskInterface {
-  virtual ~RealDiskInterface() {}
-  virtual int Stat(const std::string& path);
+  RealDiskInterface()
+      : use_cache_(false), uring_(NULL), uring_unavailable_(false) {}
+  virtual ~RealDiskInterface();
+  virtual TimeStamp Stat(const std::string& path);
+  virtual bool StatIdentity(const std::string& path, FileIdentity* identity);
   virtual bool MakeDir(const std::string& path);
   virtual std::string ReadFile(const std::string& path, std::string* err);
   virtual int RemoveFile(const std::string& path);
+  virtual void AllowStatCache(bool allow);
+  virtual bool CanPrefetch();
+  virtual void Prefetch(const std::vector<std::string>& stat_paths,
+                        const std::vector<std::string>& read_paths);
+
+ private:
+  /// Stat a path directly, bypassing the cache.
+  TimeStamp StatUncached(const std::string& path);
+
+  /// Whether Stat() may use cache_.
+  bool use_cache_;
+
+  /// Map of file name -> mtime for a single directory.  Listings of real
+  /// directories always contain "." and "..", so an empty listing means
+  /// the directory does not exist.
+  typedef hash_map<std::string, TimeStamp> DirCache;
+  /// Map of directory path -> listing.
+  typedef hash_map<std::string, DirCache> Cache;
+  Cache cache_;
+
+  /// Read and stat all the entries of \a dir into \a listing.
+  /// Returns false if the directory can't be cached.
+  bool ListDir(const std::string& dir, DirCache* listing);
+
+  /// Batches the work of Prefetch() through io_uring; Linux only.
+  struct Uring* uring_;
+  /// Set once io_uring turned out not to work, so we stop trying.
+  bool uring_unavailable_;
+
+  /// Results of Prefetch().  Files are dropped once read.
+  hash_map<std::string, TimeStamp> prefetched_mtimes_;
+  hash_map<std::string, std::string> prefetched_files_;
 };
 
 #endif  // NINJA_DISK_INTERFACE_H_
@@ -125,6 +125,29 @@ TEST_F(DiskInterfaceTest, Stat) {
   EXPECT_GT(disk_.Stat("file"), 1);
 }
 
+#ifdef linux
+TEST_F(DiskInterfaceTest, StatCache) {
+  disk_.AllowStatCache(true);
+
+  ASSERT_EQ(0, system("mkdir subdir && touch file subdir/file"));
+  EXPECT_GT(disk_.Stat("file"), 1);
+  EXPECT_GT(disk_.Stat("subdir/file"), 1);
+  EXPECT_GT(disk_.Stat("subdir"), 1);
+  EXPECT_EQ(0, disk_.Stat("nosuchfile"));
+  EXPECT_EQ(0, disk_.Stat("nosuchdir/file"));
+
+  // Changes made while the cache is allowed aren't seen...
+  ASSERT_EQ(0, system("touch newfile nosuchfile"));
+  EXPECT_EQ(0, disk_.Stat("newfile"));
+  EXPECT_EQ(0, disk_.Stat("nosuchfile"));
+
+  // ...until the cache is disallowed again.
+  disk_.AllowStatCache(false);
+  EXPECT_GT(disk_.Stat("newfile"), 1);
+  EXPECT_GT(disk_.Stat("nosuchfile"), 1);
+}
+#endif
+
 TEST_F(DiskInterfaceTest, ReadFile) {
   string err;
   EXPECT_EQ("", disk_.ReadFile("foobar", &err));
@@ -145,6 +168,19 @@ TEST_F(DiskInterfaceTest, MakeDirs) {
   EXPECT_TRUE(disk_.MakeDirs("path/with/double//slash/"));
 }
 
+TEST_F(DiskInterfaceTest, MakeDirsKnown) {
+  set<string> known;
+  EXPECT_TRUE(disk_.MakeDirs("a/b/file", &known));
+  EXPECT_EQ(2u, known.size());
+  EXPECT_TRUE(known.count("a"));
+  EXPECT_TRUE(known.count("a/b"));
+
+  // Known directories are trusted without looking at the disk.
+  known.insert("gone");
+  EXPECT_TRUE(disk_.MakeDirs("gone/file", &known));
+  EXPECT_EQ(0, disk_.Stat("gone"));
+}
+
 TEST_F(DiskInterfaceTest, RemoveFile) {
   const char* kFileName = "file-to-remove";
 #ifdef _WIN32
@@ -162,7 +198,7 @@ TEST_F(DiskInterfaceTest, RemoveFile) {
 struct StatTest : public StateTestWithBuiltinRules,
                   public DiskInterface {
   // DiskInterface implementation.
-  virtual int Stat(const string& path);
+  virtual TimeStamp Stat(const string& path);
   virtual bool MakeDir(const string& path) {
     assert(false);
     return false;
@@ -176,13 +212,13 @@ struct StatTest : public StateTestWithBuiltinRules,
     return 0;
   }
 
-  map<string, time_t> mtimes_;
+  map<string, TimeStamp> mtimes_;
   vector<string> stats_;
 };
 
-int StatTest::Stat(const string& path) {
+TimeStamp StatTest::Stat(const string& path) {
   stats_.push_back(path);
-  map<string, time_t>::iterator i = mtimes_.find(path);
+  map<string, TimeStamp>::iterator i = mtimes_.find(path);
   if (i == mtimes_.end())
     return 0;  // File not found.
   return i->second;
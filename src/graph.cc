@@ -17,8 +17,11 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <algorithm>
+
 #include "build_log.h"
 #include "disk_interface.h"
+#include "hash_cache.h"
 #include "parsers.h"
 #include "state.h"
 #include "util.h"
@@ -31,54 +34,59 @@ bool FileStat::Stat(DiskInterface* disk_interface) {
 bool Edge::RecomputeDirty(State* state, DiskInterface* disk_interface,
                           string* err) {
   bool dirty = false;
+  outputs_ready_ = true;
 
-  if (!rule_->depfile_.empty()) {
-    if (!LoadDepFile(state, disk_interface, err))
+  // Visit the inputs named in the manifest first.  Inputs discovered through
+  // the depfile are only looked at below, once we know whether we need them.
+  TimeStamp most_recent_input = 1;
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    if (is_depfile_dep(i))
+      continue;
+    if (!RecomputeInputDirty(state, disk_interface, inputs_[i],
+                             is_order_only(i), &dirty, &most_recent_input,
+                             err))
       return false;
   }
 
-  outputs_ready_ = true;
-
-  time_t most_recent_input = 1;
-  for (vector<Node*>::iterator i = inputs_.begin(); i != inputs_.end(); ++i) {
-    if ((*i)->file_->StatIfNecessary(disk_interface)) {
-      if (Edge* edge = (*i)->in_edge_) {
-        if (!edge->RecomputeDirty(state, disk_interface, err))
-          return false;
-      } else {
-        // This input has no in-edge; it is dirty if it is missing.
-        (*i)->dirty_ = !(*i)->file_->exists();
-      }
-    }
+  // We may have other outputs that our input-recursive traversal hasn't hit
+  // yet (or never will).  Stat them if we haven't already to mark that we've
+  // visited their dependents.
+  assert(!outputs_.empty());
+  // With content hashes, an old output may still be up to date.
+  HashCache* hash_cache = state ? state->hash_cache_ : 0;
+  bool outputs_stale = false;
+  for (vector<Node*>::iterator i = outputs_.begin(); i != outputs_.end(); ++i) {
+    (*i)->file_->StatIfNecessary(disk_interface);
+    if (!(*i)->file_->exists() ||
+        (!rule_->restat_ && !hash_cache &&
+         (*i)->file_->mtime_ < most_recent_input))
+      outputs_stale = true;
+  }
 
-    // If an input is not ready, neither are our outputs.
-    if (Edge* edge = (*i)->in_edge_)
-      if (!edge->outputs_ready_)
-        outputs_ready_ = false;
-
-    if (!is_order_only(i - inputs_.begin())) {
-       // If a regular input is dirty (or missing), we're dirty.
-       // Otherwise consider mtime.
-       if ((*i)->dirty_) {
-         dirty = true;
-       } else {
-         if ((*i)->file_->mtime_ > most_recent_input)
-           most_recent_input = (*i)->file_->mtime_;
-       }
+  if (!rule_->depfile_.empty()) {
+    if (depfile_loaded_)
+      depfile_loaded_ = false;
+    else if (!LoadDepFile(state, disk_interface, err))
+      return false;
+    size_t end = inputs_.size() - order_only_deps_;
+    for (size_t i = end - depfile_deps_; i < end; ++i) {
+      // A missing or out-of-date output already makes us dirty no matter
+      // what the headers say, so just record those we don't need to visit.
+      Edge* in_edge = inputs_[i]->in_edge_;
+      if (outputs_stale && (!in_edge || in_edge->outputs_ready_))
+        continue;
+      if (!RecomputeInputDirty(state, disk_interface, inputs_[i], false,
+                               &dirty, &most_recent_input, err))
+        return false;
     }
   }
 
   BuildLog* build_log = state ? state->build_log_ : 0;
   string command = EvaluateCommand();
 
-  assert(!outputs_.empty());
   for (vector<Node*>::iterator i = outputs_.begin(); i != outputs_.end(); ++i) {
-    // We may have other outputs that our input-recursive traversal hasn't hit
-    // yet (or never will).  Stat them if we haven't already to mark that we've
-    // visited their dependents.
-    (*i)->file_->StatIfNecessary(disk_interface);
-
-    RecomputeOutputDirty(build_log, most_recent_input, dirty, command, *i);
+    RecomputeOutputDirty(build_log, hash_cache, most_recent_input, dirty,
+                         command, *i);
     if ((*i)->dirty_)
       outputs_ready_ = false;
   }
@@ -86,7 +94,40 @@ bool Edge::RecomputeDirty(State* state, DiskInterface* disk_interface,
   return true;
 }
 
-void Edge::RecomputeOutputDirty(BuildLog* build_log, time_t most_recent_input,
+bool Edge::RecomputeInputDirty(State* state, DiskInterface* disk_interface,
+                               Node* input, bool order_only, bool* dirty,
+                               TimeStamp* most_recent_input, string* err) {
+  if (input->file_->StatIfNecessary(disk_interface)) {
+    if (Edge* edge = input->in_edge_) {
+      if (!edge->RecomputeDirty(state, disk_interface, err))
+        return false;
+    } else {
+      // This input has no in-edge; it is dirty if it is missing.
+      input->dirty_ = !input->file_->exists();
+    }
+  }
+
+  // If an input is not ready, neither are our outputs.
+  if (Edge* edge = input->in_edge_)
+    if (!edge->outputs_ready_)
+      outputs_ready_ = false;
+
+  if (!order_only) {
+    // If a regular input is dirty (or missing), we're dirty.
+    // Otherwise consider mtime.
+    if (input->dirty_) {
+      *dirty = true;
+    } else {
+      if (input->file_->mtime_ > *most_recent_input)
+        *most_recent_input = input->file_->mtime_;
+    }
+  }
+
+  return true;
+}
+
+void Edge::RecomputeOutputDirty(BuildLog* build_log, HashCache* hash_cache,
+                                TimeStamp most_recent_input,
                                 bool dirty, const string& command,
                                 Node* output) {
   if (is_phony()) {
@@ -111,8 +152,17 @@ void Edge::RecomputeOutputDirty(BuildLog* build_log, time_t most_recent_input,
     // build log.  Use that mtime instead, so that the file will only be
     // considered dirty if an input was modified since the previous run.
     if (rule_->restat_ && build_log &&
-        (entry = build_log->LookupByOutput(output->file_->path_))) {
-      if (entry->restat_mtime < most_recent_input)
+        (entry = build_log->LookupByOutput(output)) &&
+        entry->restat_mtime >= most_recent_input) {
+      // Clean.
+    } else if (hash_cache && build_log &&
+               (entry || (entry = build_log->LookupByOutput(output))) &&
+               entry->input_hash) {
+      // The inputs may only have been touched.  The output is clean if
+      // their contents are the same as when it was built.
+      uint64_t input_hash;
+      if (!HashInputs(hash_cache, &input_hash) ||
+          input_hash != entry->input_hash)
         output->dirty_ = true;
     } else {
       output->dirty_ = true;
@@ -124,13 +174,29 @@ void Edge::RecomputeOutputDirty(BuildLog* build_log, time_t most_recent_input,
     // But if this is a generator rule, the command changing does not make us
     // dirty.
     if (!rule_->generator_ && build_log &&
-        (entry || (entry = build_log->LookupByOutput(output->file_->path_)))) {
-      if (command != entry->command)
+        (entry || (entry = build_log->LookupByOutput(output)))) {
+      if (command != *entry->command)
         output->dirty_ = true;
     }
   }
 }
 
+bool Edge::HashInputs(HashCache* hash_cache, uint64_t* hash) {
+  *hash = 0;
+  for (vector<Node*>::iterator i = inputs_.begin();
+       i != inputs_.end() - order_only_deps_; ++i) {
+    const string& path = (*i)->file_->path_;
+    uint64_t content_hash;
+    if (!hash_cache->GetHash(path, &content_hash))
+      return false;
+    *hash = HashBytes(path.data(), path.size(), *hash ^ content_hash);
+  }
+  // Reserve 0 for "not hashed".
+  if (*hash == 0)
+    *hash = 1;
+  return true;
+}
+
 /// An Env for an Edge, providing $in and $out.
 struct EdgeEnv : public Env {
   EdgeEnv(Edge* edge) : edge_(edge) {}
@@ -170,10 +236,14 @@ string Edge::GetDescription() {
   return rule_->description_.Evaluate(&env);
 }
 
+string Edge::EvaluateDepFile() {
+  EdgeEnv env(this);
+  return rule_->depfile_.Evaluate(&env);
+}
+
 bool Edge::LoadDepFile(State* state, DiskInterface* disk_interface,
                        string* err) {
-  EdgeEnv env(this);
-  string path = rule_->depfile_.Evaluate(&env);
+  string path = EvaluateDepFile();
 
   string content = disk_interface->ReadFile(path, err);
   if (!err->empty())
@@ -196,19 +266,37 @@ bool Edge::LoadDepFile(State* state, DiskInterface* disk_interface,
     return false;
   }
 
+  // Canonicalize before touching the graph, so that an error leaves the
+  // previously loaded deps intact.
+  vector<string> paths;
+  paths.reserve(makefile.ins_.size());
+  for (vector<StringPiece>::iterator i = makefile.ins_.begin();
+       i != makefile.ins_.end(); ++i) {
+    paths.push_back(i->AsString());
+    if (!CanonicalizePath(&paths.back(), err))
+      return false;
+  }
+
+  // Forget the deps from any previous load of the depfile, so that rescanning
+  // a long-lived State doesn't accumulate duplicates.
+  vector<Node*>::iterator old_end = inputs_.end() - order_only_deps_;
+  for (vector<Node*>::iterator i = old_end - depfile_deps_; i != old_end; ++i) {
+    vector<Edge*>& out_edges = (*i)->out_edges_;
+    out_edges.erase(find(out_edges.begin(), out_edges.end(), this));
+  }
+  inputs_.erase(old_end - depfile_deps_, old_end);
+  implicit_deps_ -= depfile_deps_;
+  depfile_deps_ = makefile.ins_.size();
+
   inputs_.insert(inputs_.end() - order_only_deps_, makefile.ins_.size(), 0);
   implicit_deps_ += makefile.ins_.size();
   vector<Node*>::iterator implicit_dep =
     inputs_.end() - order_only_deps_ - makefile.ins_.size();
 
   // Add all its in-edges.
-  for (vector<StringPiece>::iterator i = makefile.ins_.begin();
-       i != makefile.ins_.end(); ++i, ++implicit_dep) {
-    string path(i->str_, i->len_);
-    if (!CanonicalizePath(&path, err))
-      return false;
-
-    Node* node = state->GetNode(path);
+  for (vector<string>::iterator i = paths.begin(); i != paths.end();
+       ++i, ++implicit_dep) {
+    Node* node = state->GetNode(*i);
     *implicit_dep = node;
     node->out_edges_.push_back(this);
 
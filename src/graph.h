@@ -19,11 +19,14 @@
 #include <vector>
 using namespace std;
 
+#include "build_log.h"
 #include "eval_env.h"
+#include "timestamp.h"
 
 struct DiskInterface;
 
 struct Node;
+struct Pool;
 
 /// Information about a single on-disk file: path, mtime.
 struct FileStat {
@@ -53,13 +56,15 @@ struct FileStat {
   //   -1: file hasn't been examined
   //   0:  we looked, and file doesn't exist
   //   >0: actual file's mtime
-  time_t mtime_;
+  TimeStamp mtime_;
   Node* node_;
 };
 
 /// An invokable build command and associated metadata (description, etc.).
 struct Rule {
-  Rule(const string& name) : name_(name), generator_(false), restat_(false) { }
+  Rule(const string& name)
+      : name_(name), generator_(false), restat_(false), shell_(false),
+        pool_(NULL) {}
 
   bool ParseCommand(const string& command, string* err) {
     return command_.Parse(command, err);
@@ -69,31 +74,56 @@ struct Rule {
   EvalString description_;
   EvalString depfile_;
   bool generator_, restat_;
+  /// Always run the command with the shell, even if it's simple enough
+  /// to run directly.
+  bool shell_;
+  /// The pool the rule's edges run in, or NULL for none.
+  Pool* pool_;
 };
 
 struct BuildLog;
+struct HashCache;
 struct Node;
 struct State;
 
 /// An edge in the dependency graph; links between Nodes using Rules.
 struct Edge {
-  Edge() : rule_(NULL), env_(NULL), outputs_ready_(false), implicit_deps_(0),
+  Edge() : rule_(NULL), pool_(NULL), env_(NULL), outputs_ready_(false),
+           depfile_loaded_(false), implicit_deps_(0), depfile_deps_(0),
            order_only_deps_(0) {}
 
+  /// Examine inputs, outputs, and the depfile to determine whether the
+  /// outputs are dirty.  The depfile's inputs are only stat()ed if the
+  /// other inputs and the outputs don't already make the edge dirty.
   bool RecomputeDirty(State* state, DiskInterface* disk_interface, string* err);
-  void RecomputeOutputDirty(BuildLog* build_log, time_t most_recent_input,
+  /// Visit a single input of this edge on behalf of RecomputeDirty().
+  bool RecomputeInputDirty(State* state, DiskInterface* disk_interface,
+                           Node* input, bool order_only, bool* dirty,
+                           TimeStamp* most_recent_input, string* err);
+  void RecomputeOutputDirty(BuildLog* build_log, HashCache* hash_cache,
+                            TimeStamp most_recent_input,
                             bool dirty, const string& command, Node* output);
+  /// Hash the paths and contents of our non-order-only inputs into
+  /// \a hash.  Returns false if an input couldn't be read.
+  bool HashInputs(HashCache* hash_cache, uint64_t* hash);
   string EvaluateCommand();  // XXX move to env, take env ptr
   string GetDescription();
+  string EvaluateDepFile();
   bool LoadDepFile(State* state, DiskInterface* disk_interface, string* err);
 
   void Dump();
 
   const Rule* rule_;
+  /// The pool the edge runs in: the rule's, unless the edge sets its own.
+  /// NULL for none.
+  Pool* pool_;
   vector<Node*> inputs_;
   vector<Node*> outputs_;
   Env* env_;
   bool outputs_ready_;
+  /// Set when the depfile was loaded ahead of the dirty scan, so that
+  /// RecomputeDirty() needn't load it again.  See Builder::Prefetch().
+  bool depfile_loaded_;
 
   bool outputs_ready() const { return outputs_ready_; }
 
@@ -109,11 +139,18 @@ struct Edge {
   // and a type of input, or if memory matters could use the low bits of the
   // pointer...)
   int implicit_deps_;
+  /// The last depfile_deps_ implicit deps were loaded from the depfile, and
+  /// are replaced when it is reloaded.
+  int depfile_deps_;
   int order_only_deps_;
   bool is_implicit(int index) {
     return index >= ((int)inputs_.size()) - order_only_deps_ - implicit_deps_ &&
         !is_order_only(index);
   }
+  bool is_depfile_dep(int index) {
+    int end = ((int)inputs_.size()) - order_only_deps_;
+    return index >= end - depfile_deps_ && index < end;
+  }
   bool is_order_only(int index) {
     return index >= ((int)inputs_.size()) - order_only_deps_;
   }
@@ -124,7 +161,9 @@ struct Edge {
 /// Information about a node in the dependency graph: the file, whether
 /// it's dirty, etc.
 struct Node {
-  Node(FileStat* file) : file_(file), dirty_(false), in_edge_(NULL) {}
+  Node(FileStat* file)
+      : file_(file), dirty_(false), in_edge_(NULL), log_entry_(NULL),
+        log_entry_source_(NULL) {}
 
   bool dirty() const { return dirty_; }
   bool ready() const { return !in_edge_ || in_edge_->outputs_ready(); }
@@ -133,6 +172,12 @@ struct Node {
   bool dirty_;
   Edge* in_edge_;
   vector<Edge*> out_edges_;
+
+  /// The entry for this node in the build log log_entry_source_, or NULL
+  /// if it has none.  Only valid once log_entry_source_ is set; see
+  /// BuildLog::LookupByOutput(Node*).
+  BuildLog::LogEntry* log_entry_;
+  const BuildLog* log_entry_source_;
 };
 
 #endif  // NINJA_GRAPH_H_
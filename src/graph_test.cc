@@ -116,6 +116,30 @@ TEST_F(GraphTest, PathWithCurrentDirectory) {
   EXPECT_FALSE(GetNode("out.o")->dirty_);
 }
 
+TEST_F(GraphTest, DepfileSkippedWhenDirty) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule catdep\n"
+"  depfile = $out.d\n"
+"  command = cat $in > $out\n"
+"build out.o: catdep foo.cc\n"));
+  fs_.Create("foo.cc", 2, "");
+  fs_.Create("out.o.d", 1, "out.o: implicit.h\n");
+  fs_.Create("out.o", 1, "");
+  fs_.Create("implicit.h", 1, "");
+
+  Edge* edge = GetNode("out.o")->in_edge_;
+  string err;
+  EXPECT_TRUE(edge->RecomputeDirty(&state_, &fs_, &err));
+  ASSERT_EQ("", err);
+
+  // foo.cc is newer than out.o, so the depfile's inputs should be recorded
+  // but not stat()ed.
+  EXPECT_TRUE(GetNode("out.o")->dirty_);
+  ASSERT_EQ(2u, edge->inputs_.size());
+  EXPECT_EQ("implicit.h", edge->inputs_[1]->file_->path_);
+  EXPECT_FALSE(GetNode("implicit.h")->file_->status_known());
+}
+
 TEST_F(GraphTest, RootNodes) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out1: cat in1\n"
@@ -0,0 +1,238 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hash_cache.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "util.h"
+
+// Implementation details:
+// As with the build log, each run appends the hashes it computed, and
+// loading keeps the last entry for each path.
+
+namespace {
+
+const char kFileSignature[] = "# ninja hashes v%d\n";
+const int kCurrentVersion = 1;
+
+}  // namespace
+
+// This is MurmurHash64A by Austin Appleby, which is in the public domain.
+uint64_t HashBytes(const void* data, size_t len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+
+  const unsigned char* p = (const unsigned char*)data;
+  const unsigned char* end = p + (len & ~(size_t)7);
+  for (; p != end; p += 8) {
+    uint64_t k;
+    memcpy(&k, p, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  switch (len & 7) {
+  case 7: h ^= uint64_t(p[6]) << 48;
+          // fall through
+  case 6: h ^= uint64_t(p[5]) << 40;
+          // fall through
+  case 5: h ^= uint64_t(p[4]) << 32;
+          // fall through
+  case 4: h ^= uint64_t(p[3]) << 24;
+          // fall through
+  case 3: h ^= uint64_t(p[2]) << 16;
+          // fall through
+  case 2: h ^= uint64_t(p[1]) << 8;
+          // fall through
+  case 1: h ^= uint64_t(p[0]);
+          h *= m;
+  };
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+HashCache::HashCache(DiskInterface* disk_interface)
+  : disk_interface_(disk_interface), file_(NULL),
+    needs_recompaction_(false) {}
+
+bool HashCache::Load(const string& path, string* err) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file) {
+    if (errno == ENOENT)
+      return true;
+    *err = strerror(errno);
+    return false;
+  }
+
+  int version = 0;
+  int unique_entry_count = 0;
+  int total_entry_count = 0;
+
+  char buf[256 << 10];
+  while (fgets(buf, sizeof(buf), file)) {
+    if (!version) {
+      if (sscanf(buf, kFileSignature, &version) > 0)
+        continue;
+      break;  // Not a file we know how to read.
+    }
+
+    char* end;
+    Entry entry;
+    entry.hash = strtoull(buf, &end, 16);
+    entry.identity.inode = strtoull(end, &end, 10);
+    entry.identity.size = strtoll(end, &end, 10);
+    entry.identity.mtime = strtoll(end, &end, 10);
+    if (*end != ' ')
+      continue;
+    char* start = end + 1;
+    end = strchr(start, '\n');
+    if (!end)
+      continue;
+
+    pair<Entries::iterator, bool> i =
+        entries_.insert(make_pair(string(start, end - start), entry));
+    if (i.second)
+      ++unique_entry_count;
+    else
+      i.first->second = entry;
+    ++total_entry_count;
+  }
+  fclose(file);
+
+  int kMinCompactionEntryCount = 1000;
+  int kCompactionRatio = 3;
+  if (version != kCurrentVersion) {
+    needs_recompaction_ = true;
+  } else if (total_entry_count > kMinCompactionEntryCount &&
+             total_entry_count > unique_entry_count * kCompactionRatio) {
+    needs_recompaction_ = true;
+  }
+  return true;
+}
+
+bool HashCache::OpenForWrite(const string& path, string* err) {
+  if (needs_recompaction_) {
+    Close();
+    if (!Recompact(path, err))
+      return false;
+    needs_recompaction_ = false;
+  }
+
+  file_ = fopen(path.c_str(), "ab");
+  if (!file_) {
+    *err = strerror(errno);
+    return false;
+  }
+  setvbuf(file_, NULL, _IOLBF, BUFSIZ);
+  SetCloseOnExec(fileno(file_));
+
+  if (ftell(file_) == 0) {
+    if (fprintf(file_, kFileSignature, kCurrentVersion) < 0) {
+      *err = strerror(errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+void HashCache::Close() {
+  if (file_)
+    fclose(file_);
+  file_ = NULL;
+}
+
+bool HashCache::GetHash(const string& path, uint64_t* hash) {
+  FileIdentity identity;
+  if (!disk_interface_->StatIdentity(path, &identity))
+    return false;
+  if (identity.mtime == 0) {
+    *hash = 0;
+    return true;
+  }
+
+  Entries::iterator i = entries_.find(path);
+  if (i != entries_.end() && i->second.identity == identity) {
+    *hash = i->second.hash;
+    return true;
+  }
+
+  string err;
+  string contents = disk_interface_->ReadFile(path, &err);
+  if (!err.empty()) {
+    Error("%s", err.c_str());
+    return false;
+  }
+
+  Entry& entry = entries_[path];
+  entry.identity = identity;
+  entry.hash = HashBytes(contents.data(), contents.size());
+  if (entry.hash == 0)
+    entry.hash = 1;  // Reserved for missing files.
+  if (file_)
+    WriteEntry(file_, path, entry);
+  *hash = entry.hash;
+  return true;
+}
+
+void HashCache::WriteEntry(FILE* f, const string& path, const Entry& entry) {
+  fprintf(f, "%016llx %llu %lld %lld %s\n",
+          (unsigned long long)entry.hash,
+          (unsigned long long)entry.identity.inode,
+          (long long)entry.identity.size, (long long)entry.identity.mtime,
+          path.c_str());
+}
+
+bool HashCache::Recompact(const string& path, string* err) {
+  string temp_path = path + ".recompact";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  if (fprintf(f, kFileSignature, kCurrentVersion) < 0) {
+    *err = strerror(errno);
+    fclose(f);
+    return false;
+  }
+
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i)
+    WriteEntry(f, i->first, i->second);
+
+  fclose(f);
+  if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  return true;
+}
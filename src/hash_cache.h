@@ -0,0 +1,69 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_HASH_CACHE_H_
+#define NINJA_HASH_CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+using namespace std;
+
+#include "disk_interface.h"
+#include "hash_map.h"
+
+/// Hash \a len bytes at \a data.  Not cryptographic; just fast and well
+/// distributed.
+uint64_t HashBytes(const void* data, size_t len, uint64_t seed = 0);
+
+/// Content hashes of files, remembered together with the FileIdentity
+/// they were computed for, so that a file is only read again after its
+/// metadata changes.  Used when the manifest sets content_hash, to tell
+/// files that were touched apart from files that were modified.
+///
+/// Like the build log, the cache is kept in a file that is appended to
+/// as new hashes are computed, and rewritten when it gets too redundant.
+struct HashCache {
+  explicit HashCache(DiskInterface* disk_interface);
+  ~HashCache() { Close(); }
+
+  /// Load the on-disk cache.  A missing file is not an error.
+  bool Load(const string& path, string* err);
+  bool OpenForWrite(const string& path, string* err);
+  void Close();
+
+  /// Get the hash of the contents of \a path into \a hash.  Missing files
+  /// hash to 0.  Returns false if the file couldn't be examined.
+  bool GetHash(const string& path, uint64_t* hash);
+
+  struct Entry {
+    FileIdentity identity;
+    uint64_t hash;
+  };
+
+  /// Serialize an entry into a cache file.
+  void WriteEntry(FILE* f, const string& path, const Entry& entry);
+
+  /// Rewrite the known entries, throwing away old data.
+  bool Recompact(const string& path, string* err);
+
+  typedef hash_map<string, Entry> Entries;
+  Entries entries_;
+  DiskInterface* disk_interface_;
+  FILE* file_;
+  bool needs_recompaction_;
+};
+
+#endif  // NINJA_HASH_CACHE_H_
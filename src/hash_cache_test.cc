@@ -0,0 +1,91 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hash_cache.h"
+
+#include "test.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static const char kTestFilename[] = "HashCacheTest-tempfile";
+
+struct HashCacheTest : public testing::Test {
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  VirtualFileSystem fs_;
+};
+
+TEST_F(HashCacheTest, OnlyRehashChangedFiles) {
+  HashCache cache(&fs_);
+  fs_.Create("a", 1, "contents");
+  fs_.Create("b", 1, "contents");
+
+  uint64_t a, b;
+  EXPECT_TRUE(cache.GetHash("a", &a));
+  EXPECT_TRUE(cache.GetHash("b", &b));
+  EXPECT_EQ(a, b);
+  EXPECT_NE(0u, a);
+  ASSERT_EQ(2u, fs_.files_read_.size());
+
+  // Same identity: answered from the cache.
+  EXPECT_TRUE(cache.GetHash("a", &a));
+  EXPECT_EQ(2u, fs_.files_read_.size());
+
+  // Touched, same contents: read again, same hash.
+  fs_.Create("a", 2, "contents");
+  EXPECT_TRUE(cache.GetHash("a", &a));
+  EXPECT_EQ(3u, fs_.files_read_.size());
+  EXPECT_EQ(b, a);
+
+  fs_.Create("a", 3, "other contents");
+  EXPECT_TRUE(cache.GetHash("a", &a));
+  EXPECT_NE(b, a);
+
+  // Missing files hash to 0 without being read.
+  uint64_t missing;
+  EXPECT_TRUE(cache.GetHash("missing", &missing));
+  EXPECT_EQ(0u, missing);
+  EXPECT_EQ(4u, fs_.files_read_.size());
+}
+
+TEST_F(HashCacheTest, WriteRead) {
+  fs_.Create("a", 1, "contents");
+  fs_.Create("dir/b c", 1, "more contents");
+  string err;
+  uint64_t a1, b1;
+  {
+    HashCache cache(&fs_);
+    EXPECT_TRUE(cache.Load(kTestFilename, &err));
+    EXPECT_TRUE(cache.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(cache.GetHash("a", &a1));
+    EXPECT_TRUE(cache.GetHash("dir/b c", &b1));
+  }
+
+  HashCache cache(&fs_);
+  EXPECT_TRUE(cache.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, cache.entries_.size());
+  fs_.files_read_.clear();
+  uint64_t a2, b2;
+  EXPECT_TRUE(cache.GetHash("a", &a2));
+  EXPECT_TRUE(cache.GetHash("dir/b c", &b2));
+  EXPECT_EQ(a1, a2);
+  EXPECT_EQ(b1, b2);
+  EXPECT_EQ(0u, fs_.files_read_.size());
+}
@@ -41,7 +41,7 @@ struct hash<std::string> {
 
 /// Equality binary predicate for const char*.
 struct ExternalStringEq {
-  bool operator()(const char* a, const char* b) {
+  bool operator()(const char* a, const char* b) const {
     return strcmp(a, b) == 0;
   }
 };
@@ -0,0 +1,229 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+
+namespace {
+
+/// Write all of \a len bytes at \a data to \a fd.
+bool WriteAll(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t ret = write(fd, data, len);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+/// Open a description of \a fd of our own, so that making it non-blocking
+/// doesn't affect the other processes sharing it.  Returns -1 on failure.
+int Reopen(int fd, int flags) {
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return open(path, flags | O_CLOEXEC);
+}
+
+}  // namespace
+
+Jobserver::Jobserver()
+    : read_fd_(-1), write_fd_(-1), had_makeflags_(false) {
+  pipe_[0] = pipe_[1] = -1;
+}
+
+Jobserver::~Jobserver() {
+  while (!tokens_.empty())
+    Release();
+  if (read_fd_ >= 0)
+    close(read_fd_);
+  if (write_fd_ >= 0 && write_fd_ != read_fd_)
+    close(write_fd_);
+
+  if (pipe_[0] >= 0) {
+    close(pipe_[0]);
+    close(pipe_[1]);
+    if (had_makeflags_)
+      setenv("MAKEFLAGS", old_makeflags_.c_str(), 1);
+    else
+      unsetenv("MAKEFLAGS");
+  }
+}
+
+bool Jobserver::Connect(const string& makeflags, string* err) {
+  // Make passes --jobserver-auth since 4.2 and --jobserver-fds before;
+  // the last one given wins.
+  const char* const kOptions[] = { "--jobserver-auth=", "--jobserver-fds=" };
+  size_t start = string::npos;
+  for (size_t i = 0; i < sizeof(kOptions) / sizeof(kOptions[0]); ++i) {
+    size_t found = makeflags.rfind(kOptions[i]);
+    if (found != string::npos &&
+        (start == string::npos || found > start)) {
+      start = found + strlen(kOptions[i]);
+    }
+  }
+  if (start == string::npos)
+    return false;
+  size_t end = makeflags.find(' ', start);
+  string auth = makeflags.substr(start, end == string::npos ?
+                                        string::npos : end - start);
+
+  if (auth.compare(0, 5, "fifo:") == 0) {
+    string path = auth.substr(5);
+    int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      *err = "jobserver fifo " + path + ": " + strerror(errno);
+      return false;
+    }
+    read_fd_ = write_fd_ = fd;
+    return true;
+  }
+
+  int read_fd, write_fd;
+  if (sscanf(auth.c_str(), "%d,%d", &read_fd, &write_fd) != 2) {
+    *err = "unknown jobserver '" + auth + "'";
+    return false;
+  }
+  // Make closes the fds for commands it doesn't consider recursive.
+  struct stat read_st, write_st;
+  if (read_fd < 0 || write_fd < 0 ||
+      fstat(read_fd, &read_st) < 0 || fstat(write_fd, &write_st) < 0 ||
+      !S_ISFIFO(read_st.st_mode) || !S_ISFIFO(write_st.st_mode)) {
+    *err = "jobserver unavailable; mark the command that runs ninja "
+           "as recursive with '+'";
+    return false;
+  }
+  return Open(read_fd, write_fd, err);
+}
+
+bool Jobserver::Create(int jobs, string* err) {
+  // Unlike a pipe, a fifo can be opened again, giving us non-blocking
+  // descriptions of our own without /proc, which not every system has.
+  // Children get plain inherited fds, which any make understands.  The
+  // fifo is unlinked once open.
+  const char* tmpdir = getenv("TMPDIR");
+  string dir = string(tmpdir && *tmpdir ? tmpdir : "/tmp") +
+      "/ninja-jobserver-XXXXXX";
+  if (!mkdtemp(&dir[0])) {
+    *err = "jobserver fifo " + dir + ": " + strerror(errno);
+    return false;
+  }
+  string path = dir + "/fifo";
+  bool ok = mkfifo(path.c_str(), 0600) == 0;
+  if (ok) {
+    // With a read end open, the write ends open without waiting.
+    pipe_[0] = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    ok = pipe_[0] >= 0;
+  }
+  if (ok) {
+    pipe_[1] = open(path.c_str(), O_WRONLY);
+    read_fd_ = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    write_fd_ = open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    ok = pipe_[1] >= 0 && read_fd_ >= 0 && write_fd_ >= 0;
+  }
+  if (!ok)
+    *err = "jobserver fifo " + path + ": " + strerror(errno);
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+
+  // The first job needs no token.  Our write end is non-blocking, in case
+  // the fifo can't hold them all.
+  if (ok) {
+    string tokens(jobs - 1, '+');
+    ok = WriteAll(write_fd_, tokens.data(), tokens.size());
+    if (!ok)
+      *err = string("filling jobserver: ") + strerror(errno);
+  }
+  if (!ok) {
+    int* fds[] = { &pipe_[0], &pipe_[1], &read_fd_, &write_fd_ };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+      if (*fds[i] >= 0)
+        close(*fds[i]);
+      *fds[i] = -1;
+    }
+    return false;
+  }
+  // Children expect their read end to block.
+  fcntl(pipe_[0], F_SETFL, 0);
+
+  // pipe_ is left open across exec for children to inherit.
+  const char* makeflags = getenv("MAKEFLAGS");
+  had_makeflags_ = makeflags != NULL;
+  if (makeflags)
+    old_makeflags_ = makeflags;
+  char flags[64];
+  snprintf(flags, sizeof(flags), "-j%d --jobserver-auth=%d,%d",
+           jobs, pipe_[0], pipe_[1]);
+  string new_makeflags = flags;
+  if (!old_makeflags_.empty()) {
+    // A first word of single-letter flags goes without its dash.
+    new_makeflags += old_makeflags_[0] == '-' ? " " : " -";
+    new_makeflags += old_makeflags_;
+  }
+  setenv("MAKEFLAGS", new_makeflags.c_str(), 1);
+  return true;
+}
+
+bool Jobserver::Open(int read_fd, int write_fd, string* err) {
+  read_fd_ = Reopen(read_fd, O_RDONLY | O_NONBLOCK);
+  write_fd_ = Reopen(write_fd, O_WRONLY);
+  if (read_fd_ < 0 || write_fd_ < 0) {
+    // Without /proc there's only the inherited description, which the
+    // other builds expect to block.  Reading a token from it could hang
+    // if another build took the token first, so don't use it at all.
+    *err = string("can't open the jobserver without blocking: ") +
+        strerror(errno);
+    if (read_fd_ >= 0)
+      close(read_fd_);
+    if (write_fd_ >= 0)
+      close(write_fd_);
+    read_fd_ = write_fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool Jobserver::Acquire() {
+  // read_fd_ is non-blocking, so a token taken by another build meanwhile
+  // makes the read fail rather than wait.
+  pollfd pfd = { read_fd_, POLLIN, 0 };
+  if (poll(&pfd, 1, 0) <= 0)
+    return false;
+  char token;
+  if (read(read_fd_, &token, 1) != 1)
+    return false;
+  tokens_.push_back(token);
+  return true;
+}
+
+void Jobserver::Release() {
+  char token = tokens_.back();
+  tokens_.pop_back();
+  if (!WriteAll(write_fd_, &token, 1))
+    Warning("returning jobserver token: %s", strerror(errno));
+}
@@ -0,0 +1,74 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_JOBSERVER_H_
+#define NINJA_JOBSERVER_H_
+
+#include <string>
+#include <vector>
+using namespace std;
+
+/// Jobserver speaks GNU make's jobserver protocol, which lets nested
+/// builds (ninja under make, make under ninja) share one limit on the
+/// number of jobs running.
+///
+/// The jobserver is a pipe (or, since make 4.4, a fifo) holding a token
+/// byte for each job that may run beyond the first; every build in the
+/// tree may always run one job without a token.  A build reads a token
+/// before starting each further job and writes it back when the job
+/// finishes.  Builds find the jobserver through --jobserver-auth in
+/// MAKEFLAGS.
+struct Jobserver {
+  Jobserver();
+  /// Returns any tokens still held, and restores MAKEFLAGS if we
+  /// exported our own.
+  ~Jobserver();
+
+  /// Join the jobserver named in \a makeflags, if it names one.  Returns
+  /// false if there is none to join; \a err is filled in if one is named
+  /// but can't be used.
+  bool Connect(const string& makeflags, string* err);
+
+  /// Serve \a jobs jobs to this process and its children through a new
+  /// fifo, and export it in MAKEFLAGS.  Fills in \a err on error.
+  bool Create(int jobs, string* err);
+
+  /// Whether we are using a jobserver.
+  bool enabled() const { return read_fd_ >= 0; }
+
+  /// Take a token for another job, if one is free.  Doesn't block.
+  bool Acquire();
+  /// Give back a token taken by Acquire().
+  void Release();
+  /// The number of tokens held.
+  int tokens() const { return (int)tokens_.size(); }
+
+ private:
+  /// Open our own non-blocking descriptions of the jobserver.  Fails if
+  /// that isn't possible (without /proc), as the shared ones could block.
+  bool Open(int read_fd, int write_fd, string* err);
+
+  int read_fd_;
+  int write_fd_;
+  /// The token bytes held, to be written back as they were read.
+  vector<char> tokens_;
+  /// The descriptions of the fifo our children inherit, if we're the
+  /// jobserver.
+  int pipe_[2];
+  /// MAKEFLAGS before we exported ours, and whether it was set.
+  string old_makeflags_;
+  bool had_makeflags_;
+};
+
+#endif  // NINJA_JOBSERVER_H_
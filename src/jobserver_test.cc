@@ -0,0 +1,155 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct JobserverTest : public testing::Test {
+  virtual void SetUp() {
+    const char* makeflags = getenv("MAKEFLAGS");
+    had_makeflags_ = makeflags != NULL;
+    if (makeflags)
+      makeflags_ = makeflags;
+    unsetenv("MAKEFLAGS");
+  }
+  virtual void TearDown() {
+    if (had_makeflags_)
+      setenv("MAKEFLAGS", makeflags_.c_str(), 1);
+    else
+      unsetenv("MAKEFLAGS");
+  }
+
+  bool had_makeflags_;
+  string makeflags_;
+};
+
+}  // namespace
+
+TEST_F(JobserverTest, NoJobserver) {
+  Jobserver jobserver;
+  string err;
+  EXPECT_FALSE(jobserver.Connect("", &err));
+  EXPECT_FALSE(jobserver.Connect("ks -j4 -- FOO=bar", &err));
+  EXPECT_EQ("", err);
+  EXPECT_FALSE(jobserver.enabled());
+}
+
+TEST_F(JobserverTest, ClosedFds) {
+  // What a command not marked recursive sees.
+  Jobserver jobserver;
+  string err;
+  EXPECT_FALSE(jobserver.Connect("-j4 --jobserver-auth=1000,1001", &err));
+  EXPECT_NE("", err);
+  EXPECT_FALSE(jobserver.enabled());
+}
+
+TEST_F(JobserverTest, Create) {
+  Jobserver jobserver;
+  string err;
+  ASSERT_TRUE(jobserver.Create(3, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(0u, string(getenv("MAKEFLAGS")).find("-j3 --jobserver-auth="));
+
+  // Two tokens, for the jobs after the first.
+  EXPECT_TRUE(jobserver.Acquire());
+  EXPECT_TRUE(jobserver.Acquire());
+  EXPECT_FALSE(jobserver.Acquire());
+  EXPECT_EQ(2, jobserver.tokens());
+  jobserver.Release();
+  EXPECT_TRUE(jobserver.Acquire());
+  EXPECT_FALSE(jobserver.Acquire());
+}
+
+TEST_F(JobserverTest, CreateLeavesChildrenBlocking) {
+  Jobserver jobserver;
+  string err;
+  ASSERT_TRUE(jobserver.Create(2, &err));
+  int read_fd, write_fd;
+  const char* makeflags = getenv("MAKEFLAGS");
+  ASSERT_EQ(2, sscanf(strstr(makeflags, "--jobserver-auth="),
+                      "--jobserver-auth=%d,%d", &read_fd, &write_fd));
+
+  // Our own reads don't block, but the fds children inherit do, as make
+  // expects.
+  EXPECT_EQ(0, fcntl(read_fd, F_GETFL) & O_NONBLOCK);
+  EXPECT_EQ(0, fcntl(read_fd, F_GETFD) & FD_CLOEXEC);
+  EXPECT_EQ(0, fcntl(write_fd, F_GETFD) & FD_CLOEXEC);
+  EXPECT_TRUE(jobserver.Acquire());
+  EXPECT_FALSE(jobserver.Acquire());
+}
+
+TEST_F(JobserverTest, SharedWithChild) {
+  Jobserver server;
+  string err;
+  ASSERT_TRUE(server.Create(3, &err));
+
+  {
+    Jobserver client;
+    ASSERT_TRUE(client.Connect(getenv("MAKEFLAGS"), &err));
+    EXPECT_TRUE(server.Acquire());
+    EXPECT_TRUE(client.Acquire());
+    EXPECT_FALSE(client.Acquire());
+    EXPECT_FALSE(server.Acquire());
+    // The client gives its token back as it exits.
+  }
+  EXPECT_TRUE(server.Acquire());
+}
+
+TEST_F(JobserverTest, KeepsMakeflags) {
+  setenv("MAKEFLAGS", "ks -- FOO=bar", 1);
+  {
+    Jobserver jobserver;
+    string err;
+    ASSERT_TRUE(jobserver.Create(2, &err));
+    string makeflags = getenv("MAKEFLAGS");
+    EXPECT_NE(string::npos, makeflags.find(" -ks -- FOO=bar"));
+  }
+  EXPECT_EQ("ks -- FOO=bar", string(getenv("MAKEFLAGS")));
+}
+
+TEST_F(JobserverTest, Fifo) {
+  char path[] = "/tmp/ninja_jobserver_testXXXXXX";
+  ASSERT_TRUE(mkdtemp(path));
+  string fifo = string(path) + "/fifo";
+  ASSERT_EQ(0, mkfifo(fifo.c_str(), 0600));
+  int fd = open(fifo.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(1, write(fd, "+", 1));
+
+  {
+    Jobserver jobserver;
+    string err;
+    ASSERT_TRUE(jobserver.Connect("-j2 --jobserver-auth=fifo:" + fifo, &err));
+    EXPECT_TRUE(jobserver.Acquire());
+    EXPECT_FALSE(jobserver.Acquire());
+  }
+  // The token came back.
+  char token;
+  EXPECT_EQ(1, read(fd, &token, 1));
+  EXPECT_EQ('+', token);
+
+  close(fd);
+  unlink(fifo.c_str());
+  rmdir(path);
+}
@@ -0,0 +1,278 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "log_stats.h"
+
+#include <algorithm>
+
+#include "build_log.h"
+#include "graph.h"
+#include "state.h"
+#include "trace.h"
+
+namespace {
+
+/// The rule of commands whose outputs aren't in the manifest.
+const char kUnknownRule[] = "(unknown)";
+
+bool SlowerThan(const LogStats::Command& a, const LogStats::Command& b) {
+  if (a.duration() != b.duration())
+    return a.duration() > b.duration();
+  return a.output < b.output;
+}
+
+bool StartsBefore(const LogStats::Command* a, const LogStats::Command* b) {
+  if (a->start_time != b->start_time)
+    return a->start_time < b->start_time;
+  return a->output < b->output;
+}
+
+typedef pair<string, LogStats::RuleStats> RuleTotal;
+
+bool MoreTotalTime(const RuleTotal& a, const RuleTotal& b) {
+  if (a.second.total_time != b.second.total_time)
+    return a.second.total_time > b.second.total_time;
+  return a.first < b.first;
+}
+
+/// Quote \a field for CSV if necessary.
+string CSVField(const string& field) {
+  if (field.find_first_of(",\"\n") == string::npos)
+    return field;
+  string quoted = "\"";
+  for (size_t i = 0; i < field.size(); ++i) {
+    if (field[i] == '"')
+      quoted += '"';
+    quoted += field[i];
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+void LogStats::Collect(State* state, BuildLog* build_log) {
+  build_log->LoadTable();
+
+  // The entries of an edge's outputs make one command.
+  map<Edge*, size_t> edge_commands;
+  for (BuildLog::Log::iterator i = build_log->log_.begin();
+       i != build_log->log_.end(); ++i) {
+    const BuildLog::LogEntry& entry = *i->second;
+    Node* node = state->LookupNode(entry.output);
+    Edge* edge = node ? node->in_edge_ : NULL;
+    if (edge) {
+      map<Edge*, size_t>::iterator c = edge_commands.find(edge);
+      if (c != edge_commands.end()) {
+        Command& command = commands_[c->second];
+        ++command.output_count;
+        // The outputs may have been logged by different builds; the
+        // latest is the one to go by.
+        if (entry.end_time > command.end_time) {
+          command.start_time = entry.start_time;
+          command.end_time = entry.end_time;
+          command.usage = entry.usage;
+        }
+        continue;
+      }
+      edge_commands[edge] = commands_.size();
+    }
+
+    Command command;
+    command.edge = edge;
+    command.rule = edge ? edge->rule_->name_ : kUnknownRule;
+    command.output = edge ? edge->outputs_[0]->file_->path_ : entry.output;
+    command.output_count = 1;
+    command.start_time = entry.start_time;
+    command.end_time = entry.end_time;
+    command.usage = entry.usage;
+    commands_.push_back(command);
+  }
+  sort(commands_.begin(), commands_.end(), SlowerThan);
+
+  for (vector<Command>::iterator i = commands_.begin(); i != commands_.end();
+       ++i) {
+    RuleStats& rule = rules_[i->rule];
+    ++rule.count;
+    rule.total_time += i->duration();
+    rule.cpu_time += i->cpu_time();
+    rule.read_bytes += i->usage.read_bytes;
+    rule.write_bytes += i->usage.write_bytes;
+  }
+}
+
+int LogStats::Span() const {
+  if (commands_.empty())
+    return 0;
+  int start = commands_[0].start_time, end = commands_[0].end_time;
+  for (vector<Command>::const_iterator i = commands_.begin();
+       i != commands_.end(); ++i) {
+    start = min(start, i->start_time);
+    end = max(end, i->end_time);
+  }
+  return end - start;
+}
+
+int64_t LogStats::BusyTime() const {
+  int64_t busy = 0;
+  for (vector<Command>::const_iterator i = commands_.begin();
+       i != commands_.end(); ++i)
+    busy += i->duration();
+  return busy;
+}
+
+int64_t LogStats::IdleTime(int parallelism) const {
+  int64_t idle = (int64_t)parallelism * Span() - BusyTime();
+  return idle > 0 ? idle : 0;
+}
+
+void LogStats::Parallelism(int bucket_count,
+                           vector<double>* parallelism) const {
+  parallelism->assign(bucket_count, 0.0);
+  int span = Span();
+  if (commands_.empty() || span == 0)
+    return;
+  int start = commands_[0].start_time;
+  for (vector<Command>::const_iterator i = commands_.begin();
+       i != commands_.end(); ++i)
+    start = min(start, i->start_time);
+
+  // Add up how long commands ran in each bucket.
+  double width = (double)span / bucket_count;
+  for (vector<Command>::const_iterator i = commands_.begin();
+       i != commands_.end(); ++i) {
+    double begin = i->start_time - start, end = i->end_time - start;
+    int first = min((int)(begin / width), bucket_count - 1);
+    for (int b = first; b < bucket_count && b * width < end; ++b) {
+      double overlap = min(end, (b + 1) * width) - max(begin, b * width);
+      if (overlap > 0)
+        (*parallelism)[b] += overlap;
+    }
+  }
+  for (int b = 0; b < bucket_count; ++b)
+    (*parallelism)[b] /= width;
+}
+
+void LogStats::PrintText(FILE* f, int slowest, int bucket_count,
+                         int cores) const {
+  slowest = min(slowest, (int)commands_.size());
+  fprintf(f, "Slowest %d of %d commands:\n", slowest, (int)commands_.size());
+  for (int i = 0; i < slowest; ++i) {
+    const Command& command = commands_[i];
+    fprintf(f, "  %9.3fs  %-16s %s", command.duration() / 1000.0,
+            command.rule.c_str(), command.output.c_str());
+    if (command.output_count > 1)
+      fprintf(f, " (+%d more)", command.output_count - 1);
+    fprintf(f, "\n");
+  }
+
+  vector<RuleTotal> rules(rules_.begin(), rules_.end());
+  sort(rules.begin(), rules.end(), MoreTotalTime);
+  fprintf(f, "\nTime by rule:\n");
+  fprintf(f, "  %-24s %8s %11s %11s %11s %9s\n", "rule", "commands",
+          "total", "average", "cpu", "io");
+  for (vector<RuleTotal>::iterator i = rules.begin(); i != rules.end(); ++i) {
+    const RuleStats& rule = i->second;
+    fprintf(f, "  %-24s %8d %10.3fs %10.3fs %10.3fs %7.1fMB\n",
+            i->first.c_str(), rule.count, rule.total_time / 1000.0,
+            rule.total_time / 1000.0 / rule.count, rule.cpu_time / 1000.0,
+            (rule.read_bytes + rule.write_bytes) / 1048576.0);
+  }
+
+  vector<double> parallelism;
+  Parallelism(bucket_count, &parallelism);
+  double most = cores;
+  for (int b = 0; b < bucket_count; ++b)
+    most = max(most, parallelism[b]);
+  const int kBarWidth = 50;
+  double width = (double)Span() / bucket_count;
+  fprintf(f, "\nCommands running at once:\n");
+  for (int b = 0; b < bucket_count; ++b) {
+    int bar = most > 0 ? (int)(parallelism[b] / most * kBarWidth + 0.5) : 0;
+    fprintf(f, "  %9.3fs  %-*s %5.1f\n", b * width / 1000.0, kBarWidth,
+            string(bar, '#').c_str(), parallelism[b]);
+  }
+
+  int64_t available = (int64_t)cores * Span();
+  fprintf(f, "\nIdle time with %d cores: %.3fs of %.3fs (%.1f%%)\n", cores,
+          IdleTime(cores) / 1000.0, available / 1000.0,
+          available ? 100.0 * IdleTime(cores) / available : 0.0);
+}
+
+void LogStats::PrintCSV(FILE* f, int slowest, int bucket_count,
+                        int cores) const {
+  slowest = min(slowest, (int)commands_.size());
+  fprintf(f, "rule,output,outputs,start_ms,end_ms,duration_ms,user_ms,"
+          "system_ms,peak_rss_kb,voluntary_switches,involuntary_switches,"
+          "read_bytes,write_bytes\n");
+  for (int i = 0; i < slowest; ++i) {
+    const Command& command = commands_[i];
+    const ResourceUsage& usage = command.usage;
+    fprintf(f, "%s,%s,%d,%d,%d,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+            CSVField(command.rule).c_str(), CSVField(command.output).c_str(),
+            command.output_count, command.start_time, command.end_time,
+            command.duration(), (unsigned long long)usage.user_time_ms,
+            (unsigned long long)usage.system_time_ms,
+            (unsigned long long)usage.peak_rss_kb,
+            (unsigned long long)usage.voluntary_switches,
+            (unsigned long long)usage.involuntary_switches,
+            (unsigned long long)usage.read_bytes,
+            (unsigned long long)usage.write_bytes);
+  }
+
+  vector<RuleTotal> rules(rules_.begin(), rules_.end());
+  sort(rules.begin(), rules.end(), MoreTotalTime);
+  fprintf(f, "\nrule,commands,total_ms,average_ms,cpu_ms,read_bytes,"
+          "write_bytes\n");
+  for (vector<RuleTotal>::iterator i = rules.begin(); i != rules.end(); ++i) {
+    const RuleStats& rule = i->second;
+    fprintf(f, "%s,%d,%lld,%.1f,%llu,%llu,%llu\n",
+            CSVField(i->first).c_str(), rule.count,
+            (long long)rule.total_time, (double)rule.total_time / rule.count,
+            (unsigned long long)rule.cpu_time,
+            (unsigned long long)rule.read_bytes,
+            (unsigned long long)rule.write_bytes);
+  }
+
+  vector<double> parallelism;
+  Parallelism(bucket_count, &parallelism);
+  double width = (double)Span() / bucket_count;
+  fprintf(f, "\nstart_ms,end_ms,parallelism\n");
+  for (int b = 0; b < bucket_count; ++b) {
+    fprintf(f, "%.0f,%.0f,%.2f\n", b * width, (b + 1) * width,
+            parallelism[b]);
+  }
+
+  fprintf(f, "\ncores,span_ms,busy_ms,idle_ms\n");
+  fprintf(f, "%d,%d,%lld,%lld\n", cores, Span(), (long long)BusyTime(),
+          (long long)IdleTime(cores));
+}
+
+void LogStats::AddToTrace(Trace* trace) const {
+  vector<const Command*> commands;
+  for (vector<Command>::const_iterator i = commands_.begin();
+       i != commands_.end(); ++i)
+    commands.push_back(&*i);
+  sort(commands.begin(), commands.end(), StartsBefore);
+
+  for (vector<const Command*>::iterator i = commands.begin();
+       i != commands.end(); ++i) {
+    const Command& command = **i;
+    string name = command.edge ? command.edge->GetDescription() : "";
+    if (name.empty())
+      name = command.output;
+    int core = trace->ScheduleCore(command.start_time, command.end_time);
+    trace->AddCommand(core, name, command.rule, command.output,
+                      command.start_time, command.end_time);
+  }
+}
@@ -0,0 +1,108 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_LOG_STATS_H_
+#define NINJA_LOG_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "resource_usage.h"
+
+struct BuildLog;
+struct Edge;
+struct State;
+struct Trace;
+
+/// LogStats summarizes the command timings recorded in a build log, for
+/// finding out where a build spends its time.
+///
+/// Start and end times in the log are relative to the start of the build
+/// that ran each command, so the figures that depend on when commands ran
+/// (parallelism and idle time) describe a single build best, e.g. one
+/// run after a clean.
+struct LogStats {
+  /// A command that produced one or more outputs.
+  struct Command {
+    /// The edge that runs the command, or NULL if it is no longer in
+    /// the manifest.
+    Edge* edge;
+    string rule;
+    /// The first output, and how many there were.
+    string output;
+    int output_count;
+    int start_time;
+    int end_time;
+    ResourceUsage usage;
+
+    int duration() const { return end_time - start_time; }
+    uint64_t cpu_time() const {
+      return usage.user_time_ms + usage.system_time_ms;
+    }
+  };
+
+  struct RuleStats {
+    RuleStats()
+        : count(0), total_time(0), cpu_time(0), read_bytes(0),
+          write_bytes(0) {}
+    int count;
+    int64_t total_time;
+    /// The totals of the commands' resource usage.
+    uint64_t cpu_time;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+  };
+
+  /// Gather the commands in \a build_log.  Their rules are looked up in
+  /// \a state; outputs it doesn't know are attributed to no rule.
+  void Collect(State* state, BuildLog* build_log);
+
+  /// The commands, slowest first.
+  vector<Command> commands_;
+  /// Totals by rule name.
+  map<string, RuleStats> rules_;
+
+  /// The time from the first command starting to the last one ending.
+  int Span() const;
+
+  /// The sum of the commands' durations.
+  int64_t BusyTime() const;
+
+  /// How long \a parallelism cores would have been idle during Span().
+  int64_t IdleTime(int parallelism) const;
+
+  /// Divide Span() into \a bucket_count periods, and get the average
+  /// number of commands running during each into \a parallelism.
+  void Parallelism(int bucket_count, vector<double>* parallelism) const;
+
+  /// Print the \a slowest slowest commands, the rule totals, a histogram
+  /// of parallelism over \a bucket_count periods, and the idle time of
+  /// \a cores cores.
+  void PrintText(FILE* f, int slowest, int bucket_count, int cores) const;
+
+  /// Print the same as PrintText(), as CSV tables separated by blank
+  /// lines.
+  void PrintCSV(FILE* f, int slowest, int bucket_count, int cores) const;
+
+  /// Add the commands to \a trace, each on the first core lane free
+  /// when it started.
+  void AddToTrace(Trace* trace) const;
+};
+
+#endif  // NINJA_LOG_STATS_H_
@@ -0,0 +1,109 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "log_stats.h"
+
+#include "build_log.h"
+#include "test.h"
+
+struct LogStatsTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    AssertParse(&state_,
+"rule cc\n"
+"  command = cc $in\n"
+"build a.o: cc a.c\n"
+"build b.o: cc b.c\n"
+"build gen1 gen2: cat in\n");
+    // An output that has since left the manifest.
+    AssertParse(&old_state_,
+"rule cat\n"
+"  command = cat $in > $out\n"
+"build old: cat in\n");
+
+    build_log_.RecordCommand(state_.edges_[0], 0, 400);
+    build_log_.RecordCommand(state_.edges_[1], 0, 200);
+    ResourceUsage usage;
+    usage.user_time_ms = 500;
+    usage.system_time_ms = 50;
+    usage.peak_rss_kb = 1024;
+    usage.write_bytes = 4096;
+    build_log_.RecordCommand(state_.edges_[2], 400, 1000, 0, 0, &usage);
+    build_log_.RecordCommand(old_state_.edges_[0], 100, 150);
+    stats_.Collect(&state_, &build_log_);
+  }
+
+  State old_state_;
+  BuildLog build_log_;
+  LogStats stats_;
+};
+
+TEST_F(LogStatsTest, Collect) {
+  ASSERT_EQ(4u, stats_.commands_.size());
+  EXPECT_EQ("gen1", stats_.commands_[0].output);
+  EXPECT_EQ(2, stats_.commands_[0].output_count);
+  EXPECT_EQ(600, stats_.commands_[0].duration());
+  EXPECT_EQ("a.o", stats_.commands_[1].output);
+  EXPECT_EQ("b.o", stats_.commands_[2].output);
+  EXPECT_EQ("old", stats_.commands_[3].output);
+  EXPECT_EQ("(unknown)", stats_.commands_[3].rule);
+
+  ASSERT_EQ(3u, stats_.rules_.size());
+  EXPECT_EQ(2, stats_.rules_["cc"].count);
+  EXPECT_EQ(600, stats_.rules_["cc"].total_time);
+  EXPECT_EQ(1, stats_.rules_["cat"].count);
+  EXPECT_EQ(550u, stats_.rules_["cat"].cpu_time);
+  EXPECT_EQ(4096u, stats_.rules_["cat"].write_bytes);
+  EXPECT_EQ(50, stats_.rules_["(unknown)"].total_time);
+}
+
+TEST_F(LogStatsTest, Times) {
+  EXPECT_EQ(1000, stats_.Span());
+  EXPECT_EQ(1250, stats_.BusyTime());
+  EXPECT_EQ(750, stats_.IdleTime(2));
+  EXPECT_EQ(0, stats_.IdleTime(1));
+
+  vector<double> parallelism;
+  stats_.Parallelism(2, &parallelism);
+  ASSERT_EQ(2u, parallelism.size());
+  EXPECT_DOUBLE_EQ(1.5, parallelism[0]);
+  EXPECT_DOUBLE_EQ(1.0, parallelism[1]);
+}
+
+TEST_F(LogStatsTest, PrintCSV) {
+  FILE* f = tmpfile();
+  ASSERT_TRUE(f);
+  stats_.PrintCSV(f, 1, 2, 2);
+  rewind(f);
+  char buf[1024];
+  size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+  buf[len] = 0;
+  fclose(f);
+  EXPECT_EQ(
+"rule,output,outputs,start_ms,end_ms,duration_ms,user_ms,system_ms,"
+"peak_rss_kb,voluntary_switches,involuntary_switches,read_bytes,"
+"write_bytes\n"
+"cat,gen1,2,400,1000,600,500,50,1024,0,0,0,4096\n"
+"\n"
+"rule,commands,total_ms,average_ms,cpu_ms,read_bytes,write_bytes\n"
+"cat,1,600,600.0,550,0,4096\n"
+"cc,2,600,300.0,0,0,0\n"
+"(unknown),1,50,50.0,0,0,0\n"
+"\n"
+"start_ms,end_ms,parallelism\n"
+"0,500,1.50\n"
+"500,1000,1.00\n"
+"\n"
+"cores,span_ms,busy_ms,idle_ms\n"
+"2,1000,1250,750\n", string(buf));
+}
@@ -0,0 +1,109 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "memory_budget.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "build_log.h"
+#include "graph.h"
+#include "util.h"
+
+MemoryBudget::MemoryBudget(uint64_t budget_kb, BuildLog* log)
+    : budget_kb_(budget_kb), log_(log), in_use_kb_(0) {}
+
+void MemoryBudget::Learn(Edge* edge) {
+  if (!log_ || edge->outputs_.empty() || !learned_.insert(edge).second)
+    return;
+  BuildLog::LogEntry* entry = log_->LookupByOutput(edge->outputs_[0]);
+  if (entry && entry->usage.peak_rss_kb)
+    AddSample(edge->rule_, entry->usage.peak_rss_kb);
+}
+
+uint64_t MemoryBudget::Estimate(Edge* edge) {
+  if (edge->is_phony())
+    return 0;
+  if (log_ && !edge->outputs_.empty()) {
+    BuildLog::LogEntry* entry = log_->LookupByOutput(edge->outputs_[0]);
+    if (entry && entry->usage.peak_rss_kb)
+      return entry->usage.peak_rss_kb;
+  }
+  map<const Rule*, pair<uint64_t, int> >::iterator i =
+      rules_.find(edge->rule_);
+  if (i == rules_.end())
+    return 0;
+  return i->second.first / i->second.second;
+}
+
+bool MemoryBudget::Fits(Edge* edge) {
+  if (!budget_kb_ || running_.empty())
+    return true;
+  return in_use_kb_ + Estimate(edge) <= budget_kb_;
+}
+
+void MemoryBudget::CommandStarted(Edge* edge) {
+  uint64_t estimate = Estimate(edge);
+  running_[edge] = estimate;
+  in_use_kb_ += estimate;
+}
+
+void MemoryBudget::CommandFinished(Edge* edge, uint64_t peak_rss_kb) {
+  map<Edge*, uint64_t>::iterator i = running_.find(edge);
+  if (i != running_.end()) {
+    in_use_kb_ -= i->second;
+    running_.erase(i);
+  }
+  // Commands of the rule that haven't run yet can go by this one.
+  if (peak_rss_kb && learned_.insert(edge).second)
+    AddSample(edge->rule_, peak_rss_kb);
+}
+
+void MemoryBudget::AddSample(const Rule* rule, uint64_t peak_rss_kb) {
+  pair<uint64_t, int>& stats = rules_[rule];
+  stats.first += peak_rss_kb;
+  ++stats.second;
+}
+
+uint64_t GetAvailableMemoryKB() {
+#if defined(_WIN32)
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return 0;
+  return status.ullAvailPhys / 1024;
+#else
+  // Linux counts reclaimable caches as available, which free memory
+  // doesn't.
+  string meminfo, err;
+  if (ReadFile("/proc/meminfo", &meminfo, &err) == 0) {
+    const char kAvailable[] = "MemAvailable:";
+    size_t pos = meminfo.find(kAvailable);
+    if (pos != string::npos)
+      return strtoull(meminfo.c_str() + pos + strlen(kAvailable), NULL, 10);
+  }
+#ifdef _SC_AVPHYS_PAGES
+  long pages = sysconf(_SC_AVPHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (pages > 0 && page_size > 0)
+    return (uint64_t)pages * (page_size / 1024);
+#endif
+  return 0;
+#endif
+}
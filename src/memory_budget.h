@@ -0,0 +1,81 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MEMORY_BUDGET_H_
+#define NINJA_MEMORY_BUDGET_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+using namespace std;
+
+struct BuildLog;
+struct Edge;
+struct Rule;
+
+/// MemoryBudget keeps the commands running at once from together needing
+/// more memory than the budget, so that e.g. several big links don't
+/// start at once and wake the OOM killer.
+///
+/// A command is expected to need the peak resident memory it had when it
+/// last ran, from the build log.  A command without history is expected
+/// to need the average of its rule's commands that have some.
+struct MemoryBudget {
+  /// Admit commands while they fit in \a budget_kb, or all of them if it
+  /// is 0.  History is read from \a log, which may be NULL.
+  MemoryBudget(uint64_t budget_kb, BuildLog* log);
+
+  /// Learn from the log what \a edge's rule needs.  Each edge is counted
+  /// once.
+  void Learn(Edge* edge);
+
+  /// How much memory \a edge's command is expected to need, or 0 if
+  /// nothing is known.
+  uint64_t Estimate(Edge* edge);
+
+  /// Whether \a edge can start alongside the commands running now.  Any
+  /// command can start when none are running.
+  bool Fits(Edge* edge);
+
+  /// Count \a edge's command as running.
+  void CommandStarted(Edge* edge);
+  /// Stop counting \a edge's command, which needed \a peak_rss_kb (0 if
+  /// unknown).
+  void CommandFinished(Edge* edge, uint64_t peak_rss_kb);
+
+  uint64_t budget_kb() const { return budget_kb_; }
+  /// The memory expected to be needed by the commands running now.
+  uint64_t in_use_kb() const { return in_use_kb_; }
+
+ private:
+  /// Count \a peak_rss_kb towards the average of \a rule.
+  void AddSample(const Rule* rule, uint64_t peak_rss_kb);
+
+  uint64_t budget_kb_;
+  BuildLog* log_;
+  uint64_t in_use_kb_;
+  /// The estimate counted for each running command.
+  map<Edge*, uint64_t> running_;
+  /// The total peak memory and the number of commands seen for each
+  /// rule.
+  map<const Rule*, pair<uint64_t, int> > rules_;
+  set<Edge*> learned_;
+};
+
+/// The memory available for new processes without swapping, or 0 if it
+/// can't be told.
+uint64_t GetAvailableMemoryKB();
+
+#endif  // NINJA_MEMORY_BUDGET_H_
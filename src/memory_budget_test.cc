@@ -0,0 +1,84 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "memory_budget.h"
+
+#include "build_log.h"
+#include "graph.h"
+#include "test.h"
+
+struct MemoryBudgetTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    AssertParse(&state_,
+"rule link\n"
+"  command = link $out\n"
+"build a: link in\n"
+"build b: link in\n"
+"build c: link in\n"
+"build d: cat in\n");
+  }
+
+  /// Log \a edge as having needed \a peak_rss_kb.
+  void Record(Edge* edge, uint64_t peak_rss_kb) {
+    ResourceUsage usage;
+    usage.peak_rss_kb = peak_rss_kb;
+    log_.RecordCommand(edge, 0, 1, 0, 0, &usage);
+  }
+
+  Edge* GetEdge(const string& path) { return GetNode(path)->in_edge_; }
+
+  BuildLog log_;
+};
+
+TEST_F(MemoryBudgetTest, Estimate) {
+  Record(GetEdge("a"), 300);
+  Record(GetEdge("b"), 500);
+  MemoryBudget budget(1000, &log_);
+  for (int i = 0; i < 4; ++i)
+    budget.Learn(state_.edges_[i]);
+  budget.Learn(GetEdge("a"));
+
+  EXPECT_EQ(300u, budget.Estimate(GetEdge("a")));
+  // No history: the average of the rule.
+  EXPECT_EQ(400u, budget.Estimate(GetEdge("c")));
+  EXPECT_EQ(0u, budget.Estimate(GetEdge("d")));
+}
+
+TEST_F(MemoryBudgetTest, Fits) {
+  Record(GetEdge("a"), 600);
+  Record(GetEdge("b"), 600);
+  MemoryBudget budget(1000, &log_);
+
+  // The first command always fits.
+  EXPECT_TRUE(budget.Fits(GetEdge("a")));
+  budget.CommandStarted(GetEdge("a"));
+  EXPECT_EQ(600u, budget.in_use_kb());
+  EXPECT_FALSE(budget.Fits(GetEdge("b")));
+  EXPECT_TRUE(budget.Fits(GetEdge("d")));
+
+  budget.CommandFinished(GetEdge("a"), 700);
+  EXPECT_EQ(0u, budget.in_use_kb());
+  EXPECT_TRUE(budget.Fits(GetEdge("b")));
+
+  // What a command needed goes towards its rule's average.
+  EXPECT_EQ(700u, budget.Estimate(GetEdge("c")));
+}
+
+TEST_F(MemoryBudgetTest, NoBudget) {
+  Record(GetEdge("a"), 600);
+  Record(GetEdge("b"), 600);
+  MemoryBudget budget(0, &log_);
+  budget.CommandStarted(GetEdge("a"));
+  EXPECT_TRUE(budget.Fits(GetEdge("b")));
+}
@@ -36,11 +36,21 @@
 #include "build.h"
 #include "build_log.h"
 #include "clean.h"
+#include "disk_interface.h"
 #include "graph.h"
 #include "graphviz.h"
+#include "hash_cache.h"
+#include "log_stats.h"
 #include "parsers.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
+#ifndef _WIN32
+#include "server.h"
+#endif
+#ifdef linux
+#include "watch.h"
+#endif
 
 namespace {
 
@@ -58,9 +68,25 @@ void Usage(const BuildConfig& config) {
 "  -f FILE  specify input build file [default=build.ninja]\n"
 "  -j N     run N jobs in parallel [default=%d]\n"
 "  -k N     keep going until N jobs fail [default=1]\n"
+"  -l N     run fewer jobs while the load average is above N\n"
 "  -n       dry run (don't run commands but pretend they succeeded)\n"
 "  -v       show all command lines\n"
+"  -w       watch for changes to inputs and rebuild continuously\n"
 "  -C DIR   change to DIR before doing anything else\n"
+"  --make-dirs-first\n"
+"           create all output directories before running any command\n"
+"  --trace FILE\n"
+"           write a Chrome trace of the build to FILE\n"
+"  --output-limit MB\n"
+"           keep up to MB of each command's output in memory and spill\n"
+"           the rest to a temporary file [default=%d]\n"
+"  --max-pressure PCT\n"
+"           run fewer jobs while the CPU, memory or IO pressure (Linux\n"
+"           PSI) is above PCT percent\n"
+"  --memory-budget MB\n"
+"           don't start a job if the jobs running would then need more\n"
+"           than MB of memory, going by the build log; 0 to not check\n"
+"           [default=the memory available at the start]\n"
 "\n"
 "  -t TOOL  run a subtool.\n"
 "           terminates toplevel options; further flags are passed to the tool.\n"
@@ -71,8 +97,13 @@ void Usage(const BuildConfig& config) {
 "             targets  list targets by their rule or depth in the DAG\n"
 "             rules    list all rules\n"
 "             commands list all commands required to rebuild given targets\n"
-"             clean    clean built files\n",
-          config.parallelism);
+"             clean    clean built files\n"
+"             recompact  recompact the build log, dropping entries for\n"
+"                        outputs that are no longer built\n"
+"             logstats summarize command times from the build log\n"
+"             trace    write a Chrome trace of the commands in the build log\n"
+"             server   keep the build loaded and serve ninja_client requests\n",
+          config.parallelism, (int)(config.output_limit >> 20));
 }
 
 /// Choose a default value for the -j (parallelism) flag.
@@ -114,6 +145,16 @@ struct RealFileReader : public ManifestParser::FileReader {
   }
 };
 
+/// A ManifestParser::FileReader that remembers the files it read, so that
+/// a server or -w can tell when it needs to reload the manifest.
+struct RecordingFileReader : public RealFileReader {
+  bool ReadFile(const string& path, string* content, string* err) {
+    paths_.push_back(path);
+    return RealFileReader::ReadFile(path, content, err);
+  }
+  vector<string> paths_;
+};
+
 /// Rebuild the build manifest, if necessary.
 /// Returns true if the manifest was rebuilt.
 bool RebuildManifest(State* state, const BuildConfig& config,
@@ -387,6 +428,100 @@ int CmdCommands(State* state, int argc, char* argv[]) {
   return 0;
 }
 
+/// Load the build log for \a state into \a build_log, creating the build
+/// directory if necessary.  The log's path is returned in \a log_path.
+bool LoadBuildLog(State* state, BuildLog* build_log, string* log_path,
+                  string* err) {
+  const string build_dir = state->bindings_.LookupVariable("builddir");
+  const char* kLogPath = ".ninja_log";
+  *log_path = kLogPath;
+  if (!build_dir.empty()) {
+    if (MakeDir(build_dir) < 0 && errno != EEXIST) {
+      *err = "creating build directory " + build_dir + ": " + strerror(errno);
+      return false;
+    }
+    *log_path = build_dir + "/" + kLogPath;
+  }
+
+  if (!build_log->Load(log_path->c_str(), err)) {
+    *err = "loading build log " + *log_path + ": " + *err;
+    return false;
+  }
+  state->build_log_ = build_log;
+  build_log->SetState(state);
+  return true;
+}
+
+int CmdRecompact(State* state) {
+  BuildLog build_log;
+  string log_path, err;
+  if (!LoadBuildLog(state, &build_log, &log_path, &err) ||
+      !build_log.Recompact(log_path, &err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  return 0;
+}
+
+int CmdLogStats(State* state, int argc, char* argv[],
+                const BuildConfig& config) {
+  int slowest = 10;
+  int bucket_count = 20;
+  bool csv = false;
+
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:b:c")) != -1) {
+    switch (opt) {
+      case 'n':
+        slowest = atoi(optarg);
+        break;
+      case 'b':
+        bucket_count = atoi(optarg);
+        break;
+      case 'c':
+        csv = true;
+        break;
+      default:
+        Usage(config);
+        return 1;
+    }
+  }
+  if (slowest < 0 || bucket_count < 1) {
+    Error("invalid -n or -b");
+    return 1;
+  }
+
+  BuildLog build_log;
+  string log_path, err;
+  if (!LoadBuildLog(state, &build_log, &log_path, &err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  LogStats stats;
+  stats.Collect(state, &build_log);
+  if (csv)
+    stats.PrintCSV(stdout, slowest, bucket_count, config.parallelism);
+  else
+    stats.PrintText(stdout, slowest, bucket_count, config.parallelism);
+  return 0;
+}
+
+int CmdTrace(State* state) {
+  BuildLog build_log;
+  string log_path, err;
+  if (!LoadBuildLog(state, &build_log, &log_path, &err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  LogStats stats;
+  stats.Collect(state, &build_log);
+  Trace trace;
+  trace.Open(stdout);
+  stats.AddToTrace(&trace);
+  return 0;
+}
+
 int CmdClean(State* state, int argc, char* argv[], const BuildConfig& config) {
   bool generator = false;
   bool clean_rules = false;
@@ -425,128 +560,504 @@ int CmdClean(State* state, int argc, char* argv[], const BuildConfig& config) {
   }
 }
 
-}  // anonymous namespace
+/// Build \a targets, recording the build in \a trace if it's non-NULL.
+/// Returns the exit code for the build.
+int RunBuild(State* state, const BuildConfig& config,
+             const vector<Node*>& targets, Trace* trace) {
+  string err;
+  Builder builder(state, config);
+  builder.trace_ = trace;
+  int64_t scan_start = trace ? trace->Now() : 0;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (!builder.AddTarget(targets[i], &err)) {
+      if (!err.empty()) {
+        Error("%s", err.c_str());
+        return 1;
+      } else {
+        // Added a target that is already up-to-date; not really
+        // an error.
+      }
+    }
+  }
+  if (trace)
+    trace->AddPhase("dirty scan", scan_start, trace->Now());
 
-int main(int argc, char** argv) {
-  const char* ninja_command = argv[0];
-  BuildConfig config;
-  const char* input_file = "build.ninja";
-  const char* working_dir = 0;
-  string tool;
+  if (builder.AlreadyUpToDate()) {
+    printf("ninja: no work to do.\n");
+    return 0;
+  }
 
-  setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+  if (!builder.Build(&err)) {
+    printf("ninja: build stopped: %s.\n", err.c_str());
+    return 1;
+  }
 
-  config.parallelism = GuessParallelism();
+  return 0;
+}
 
+/// Forget the status of every node a build was meant to update: those it
+/// built have new mtimes, and those it didn't get to may have changed too.
+void ResetDirtyNodes(State* state) {
+  for (vector<Edge*>::iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    for (vector<Node*>::iterator out = (*e)->outputs_.begin();
+         out != (*e)->outputs_.end(); ++out) {
+      if ((*out)->dirty_)
+        state->ResetNode(*out);
+    }
+  }
+}
+
+/// Flags from the command line that aren't part of the BuildConfig.
+struct Options {
+  Options() : input_file("build.ninja"), working_dir(NULL), trace_file(NULL),
+              watch(false) {}
+
+  const char* input_file;
+  const char* working_dir;
+  const char* trace_file;
+  string tool;
+  bool watch;
+};
+
+/// Parse the flags in \a argc and \a argv into \a options and \a config, and
+/// advance them past the flags.  Returns false if ninja should exit; \a err
+/// is filled in if a flag was bad.
+bool ReadFlags(int* argc, char*** argv, Options* options,
+               BuildConfig* config, string* err) {
+  enum {
+    OPT_MAKE_DIRS_FIRST = 1, OPT_TRACE, OPT_OUTPUT_LIMIT, OPT_MAX_PRESSURE,
+    OPT_MEMORY_BUDGET
+  };
   const option kLongOptions[] = {
     { "help", no_argument, NULL, 'h' },
+    { "make-dirs-first", no_argument, NULL, OPT_MAKE_DIRS_FIRST },
+    { "trace", required_argument, NULL, OPT_TRACE },
+    { "output-limit", required_argument, NULL, OPT_OUTPUT_LIMIT },
+    { "max-pressure", required_argument, NULL, OPT_MAX_PRESSURE },
+    { "memory-budget", required_argument, NULL, OPT_MEMORY_BUDGET },
     { }
   };
 
   int opt;
-  while (tool.empty() &&
-         (opt = getopt_long(argc, argv, "f:hj:k:nt:vC:", kLongOptions,
+  while (options->tool.empty() &&
+         (opt = getopt_long(*argc, *argv, "f:hj:k:l:nt:vwC:", kLongOptions,
                             NULL)) != -1) {
     switch (opt) {
       case 'f':
-        input_file = optarg;
+        options->input_file = optarg;
         break;
       case 'j':
-        config.parallelism = atoi(optarg);
+        config->parallelism = atoi(optarg);
         break;
       case 'k': {
         char* end;
         int value = strtol(optarg, &end, 10);
-        if (*end != 0)
-          Fatal("-k parameter not numeric; did you mean -k0?");
+        if (*end != 0) {
+          *err = "-k parameter not numeric; did you mean -k0?";
+          return false;
+        }
 
         // We want to go until N jobs fail, which means we should ignore
         // the first N-1 that fail and then stop.
-        config.swallow_failures = value - 1;
+        config->swallow_failures = value - 1;
+        break;
+      }
+      case 'l': {
+        char* end;
+        double value = strtod(optarg, &end);
+        if (end == optarg || *end != 0) {
+          *err = "-l parameter not numeric: did you mean -l 0.0?";
+          return false;
+        }
+        config->max_load_average = value;
         break;
       }
       case 'n':
-        config.dry_run = true;
+        config->dry_run = true;
         break;
       case 'v':
-        config.verbosity = BuildConfig::VERBOSE;
+        config->verbosity = BuildConfig::VERBOSE;
+        break;
+      case 'w':
+        options->watch = true;
         break;
       case 't':
-        tool = optarg;
+        options->tool = optarg;
         break;
       case 'C':
-        working_dir = optarg;
+        options->working_dir = optarg;
         break;
+      case OPT_MAKE_DIRS_FIRST:
+        config->make_dirs_first = true;
+        break;
+      case OPT_TRACE:
+        options->trace_file = optarg;
+        break;
+      case OPT_OUTPUT_LIMIT: {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value < 0) {
+          *err = "--output-limit parameter not a number of megabytes";
+          return false;
+        }
+        config->output_limit = (size_t)value << 20;
+        break;
+      }
+      case OPT_MAX_PRESSURE: {
+        char* end;
+        double value = strtod(optarg, &end);
+        if (end == optarg || *end != 0) {
+          *err = "--max-pressure parameter not a percentage";
+          return false;
+        }
+        config->max_pressure = value;
+        break;
+      }
+      case OPT_MEMORY_BUDGET: {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value < 0) {
+          *err = "--memory-budget parameter not a number of megabytes";
+          return false;
+        }
+        config->memory_budget_kb = (int64_t)value << 10;
+        break;
+      }
       case 'h':
       default:
-        Usage(config);
+        Usage(*config);
+        return false;
+    }
+  }
+  *argv += optind;
+  *argc -= optind;
+  return true;
+}
+
+/// Run the tool named \a tool.  Returns its exit code.
+int RunTool(State* state, const string& tool, const char* ninja_command,
+            int argc, char* argv[], const BuildConfig& config) {
+  if (tool == "graph")
+    return CmdGraph(state, argc, argv);
+  if (tool == "query")
+    return CmdQuery(state, argc, argv);
+  if (tool == "browse")
+    return CmdBrowse(state, ninja_command, argc, argv);
+  if (tool == "targets")
+    return CmdTargets(state, argc, argv);
+  if (tool == "rules")
+    return CmdRules(state, argc, argv);
+  if (tool == "commands")
+    return CmdCommands(state, argc, argv);
+  if (tool == "recompact")
+    return CmdRecompact(state);
+  if (tool == "trace")
+    return CmdTrace(state);
+  if (tool == "logstats")
+    return CmdLogStats(state, argc+1, argv-1, config);
+  // The clean tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "clean".
+  if (tool == "clean")
+    return CmdClean(state, argc+1, argv-1, config);
+  Error("unknown tool '%s'", tool.c_str());
+  return 1;
+}
+
+/// If the manifest asks for content hashes, load \a hash_cache and open
+/// it for appending the hashes computed in this run.
+bool LoadHashCache(State* state, HashCache* hash_cache, string* err) {
+  if (state->bindings_.LookupVariable("content_hash").empty())
+    return true;
+
+  const string build_dir = state->bindings_.LookupVariable("builddir");
+  string path = ".ninja_hashes";
+  if (!build_dir.empty())
+    path = build_dir + "/" + path;
+  if (!hash_cache->Load(path, err) || !hash_cache->OpenForWrite(path, err)) {
+    *err = "loading hash cache " + path + ": " + *err;
+    return false;
+  }
+  state->hash_cache_ = hash_cache;
+  return true;
+}
+
+#ifndef _WIN32
+/// Runs the requests of ninja_client against a State and BuildLog kept in
+/// memory.  Between requests it only stat()s the manifest files and the
+/// build log to check whether it must reload them; everything else is
+/// re-examined by the usual dirty scan after State::Reset().
+struct NinjaServer : public Server::Delegate {
+  NinjaServer(const char* ninja_command, const char* input_file)
+      : ninja_command_(ninja_command), input_file_(input_file),
+        state_(NULL), build_log_(NULL), hash_cache_(NULL) {}
+  virtual ~NinjaServer() {
+    delete hash_cache_;
+    delete build_log_;
+    delete state_;
+  }
+
+  /// (Re)load the manifest and build log.
+  bool Load(string* err);
+
+  /// Return true if none of the files we loaded has changed since.
+  bool UpToDate();
+
+  /// Remember the current mtime of the build log, after we've written it.
+  void RecordLogMtime() {
+    mtimes_[log_path_] = disk_interface_.Stat(log_path_);
+  }
+
+  virtual int HandleRequest(int argc, char** argv);
+
+  /// Handle a build (i.e. non-tool) request.
+  int RunBuildRequest(int argc, char** argv, const Options& options,
+                      const BuildConfig& config);
+
+  const char* ninja_command_;
+  string input_file_;
+  State* state_;
+  BuildLog* build_log_;
+  HashCache* hash_cache_;
+  string log_path_;
+  RealDiskInterface disk_interface_;
+
+  /// Files we loaded, and their mtimes at the time.
+  map<string, TimeStamp> mtimes_;
+};
+
+bool NinjaServer::Load(string* err) {
+  delete hash_cache_;
+  delete build_log_;
+  delete state_;
+  state_ = new State;
+  build_log_ = new BuildLog;
+  hash_cache_ = new HashCache(&disk_interface_);
+  mtimes_.clear();
+
+  RecordingFileReader file_reader;
+  ManifestParser parser(state_, &file_reader);
+  // Stat before parsing, so that an edit racing with the load is seen
+  // next time.
+  TimeStamp manifest_mtime = disk_interface_.Stat(input_file_);
+  if (!parser.Load(input_file_, err)) {
+    *err = "loading '" + input_file_ + "': " + *err;
+    return false;
+  }
+  for (vector<string>::iterator i = file_reader.paths_.begin();
+       i != file_reader.paths_.end(); ++i)
+    mtimes_[*i] = disk_interface_.Stat(*i);
+  mtimes_[input_file_] = manifest_mtime;
+
+  if (!LoadBuildLog(state_, build_log_, &log_path_, err))
+    return false;
+  RecordLogMtime();
+  if (!LoadHashCache(state_, hash_cache_, err))
+    return false;
+  return true;
+}
+
+bool NinjaServer::UpToDate() {
+  if (!state_)
+    return false;
+  for (map<string, TimeStamp>::iterator i = mtimes_.begin();
+       i != mtimes_.end(); ++i) {
+    if (disk_interface_.Stat(i->first) != i->second)
+      return false;
+  }
+  return true;
+}
+
+int NinjaServer::HandleRequest(int argc, char** argv) {
+  Options options;
+  BuildConfig config;
+  config.parallelism = GuessParallelism();
+  optind = 0;  // Fully reset getopt.
+  string err;
+  if (!ReadFlags(&argc, &argv, &options, &config, &err)) {
+    // A bad flag is the client's problem; the server carries on.
+    if (!err.empty())
+      Error("%s", err.c_str());
+    return 1;
+  }
+
+  // -C was already taken care of by the client.
+  if (input_file_ != options.input_file) {
+    Error("this server builds '%s'", input_file_.c_str());
+    return 1;
+  }
+  if (options.watch || options.trace_file || options.tool == "browse" ||
+      options.tool == "server") {
+    Error("not supported by the server; run ninja directly");
+    return 1;
+  }
+
+  if (!UpToDate() && !Load(&err)) {
+    Error("%s", err.c_str());
+    delete state_;
+    state_ = NULL;
+    return 1;
+  }
+
+  if (!options.tool.empty()) {
+    int status = RunTool(state_, options.tool, ninja_command_, argc, argv,
+                         config);
+    // Tools like clean modify the disk, and tools like logstats point
+    // the state at a build log of their own.
+    state_->Reset();
+    state_->build_log_ = build_log_;
+    return status;
+  }
+
+  int status = RunBuildRequest(argc, argv, options, config);
+  build_log_->Close();
+  RecordLogMtime();
+  return status;
+}
+
+int NinjaServer::RunBuildRequest(int argc, char** argv, const Options& options,
+                                 const BuildConfig& config) {
+  string err;
+  for (int attempt = 0; ; ++attempt) {
+    // Forget what we knew about the disk; the dirty scan will stat what it
+    // needs again.
+    state_->Reset();
+    build_log_->SetConfig((BuildConfig*)&config);
+    if (!build_log_->OpenForWrite(log_path_, &err)) {
+      Error("opening build log: %s", err.c_str());
+      return 1;
+    }
+
+    // As in main(), rebuild the manifest at most once.
+    if (attempt > 0)
+      break;
+    if (RebuildManifest(state_, config, options.input_file, &err)) {
+      build_log_->Close();
+      if (!Load(&err)) {
+        Error("%s", err.c_str());
+        delete state_;
+        state_ = NULL;
         return 1;
+      }
+      continue;
+    } else if (!err.empty()) {
+      Error("rebuilding '%s': %s", options.input_file, err.c_str());
+      return 1;
     }
+    break;
   }
-  argv += optind;
-  argc -= optind;
 
-  if (working_dir) {
+  vector<Node*> targets;
+  if (!CollectTargetsFromArgs(state_, argc, argv, &targets, &err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  return RunBuild(state_, config, targets, NULL);
+}
+
+/// Run a server for ninja_client in the current directory.
+int RunServer(const char* ninja_command, const char* input_file) {
+  NinjaServer ninja_server(ninja_command, input_file);
+  string err;
+  if (!ninja_server.Load(&err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+
+  Server server(&ninja_server);
+  if (!server.Listen(&err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  printf("ninja: serving requests on %s\n", kServerSocketPath);
+  if (!server.Serve(&err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  return 0;
+}
+#endif  // _WIN32
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  const char* ninja_command = argv[0];
+  BuildConfig config;
+  Options options;
+
+  setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+
+  config.parallelism = GuessParallelism();
+
+  string flags_err;
+  if (!ReadFlags(&argc, &argv, &options, &config, &flags_err)) {
+    if (!flags_err.empty())
+      Error("%s", flags_err.c_str());
+    return 1;
+  }
+  const char* input_file = options.input_file;
+
+  if (options.working_dir) {
 #ifdef _WIN32
-    if (_chdir(working_dir) < 0) {
+    if (_chdir(options.working_dir) < 0) {
 #else
-    if (chdir(working_dir) < 0) {
+    if (chdir(options.working_dir) < 0) {
 #endif
-      Fatal("chdir to '%s' - %s", working_dir, strerror(errno));
+      Fatal("chdir to '%s' - %s", options.working_dir, strerror(errno));
     }
   }
 
+  if (options.tool == "server") {
+#ifndef _WIN32
+    return RunServer(ninja_command, input_file);
+#else
+    Error("server mode not yet supported on Windows");
+    return 1;
+#endif
+  }
+
+  Trace trace;
+  Trace* build_trace = NULL;
+  if (options.trace_file) {
+    string err;
+    if (!trace.Open(options.trace_file, &err)) {
+      Error("opening trace %s: %s", options.trace_file, err.c_str());
+      return 1;
+    }
+    build_trace = &trace;
+  }
+
   bool rebuilt_manifest = false;
 
 reload:
   State state;
-  RealFileReader file_reader;
+  RecordingFileReader file_reader;
   ManifestParser parser(&state, &file_reader);
   string err;
+  int64_t load_start = trace.Now();
   if (!parser.Load(input_file, &err)) {
     Error("loading '%s': %s", input_file, err.c_str());
     return 1;
   }
+  trace.AddPhase("load manifest", load_start, trace.Now());
 
-  if (!tool.empty()) {
-    if (tool == "graph")
-      return CmdGraph(&state, argc, argv);
-    if (tool == "query")
-      return CmdQuery(&state, argc, argv);
-    if (tool == "browse")
-      return CmdBrowse(&state, ninja_command, argc, argv);
-    if (tool == "targets")
-      return CmdTargets(&state, argc, argv);
-    if (tool == "rules")
-      return CmdRules(&state, argc, argv);
-    if (tool == "commands")
-      return CmdCommands(&state, argc, argv);
-    // The clean tool uses getopt, and expects argv[0] to contain the name of
-    // the tool, i.e. "clean".
-    if (tool == "clean")
-      return CmdClean(&state, argc+1, argv-1, config);
-    Error("unknown tool '%s'", tool.c_str());
-  }
+  if (!options.tool.empty())
+    return RunTool(&state, options.tool, ninja_command, argc, argv, config);
 
   BuildLog build_log;
   build_log.SetConfig(&config);
-  state.build_log_ = &build_log;
-
-  const string build_dir = state.bindings_.LookupVariable("builddir");
-  const char* kLogPath = ".ninja_log";
-  string log_path = kLogPath;
-  if (!build_dir.empty()) {
-    if (MakeDir(build_dir) < 0 && errno != EEXIST) {
-      Error("creating build directory %s: %s",
-            build_dir.c_str(), strerror(errno));
-      return 1;
-    }
-    log_path = build_dir + "/" + kLogPath;
+  string log_path;
+  load_start = trace.Now();
+  if (!LoadBuildLog(&state, &build_log, &log_path, &err)) {
+    Error("%s", err.c_str());
+    return 1;
   }
+  trace.AddPhase("load build log", load_start, trace.Now());
 
-  if (!build_log.Load(log_path.c_str(), &err)) {
-    Error("loading build log %s: %s",
-          log_path.c_str(), err.c_str());
+  RealDiskInterface disk_interface;
+  HashCache hash_cache(&disk_interface);
+  if (!LoadHashCache(&state, &hash_cache, &err)) {
+    Error("%s", err.c_str());
     return 1;
   }
 
@@ -572,28 +1083,68 @@ reload:
     return 1;
   }
 
-  Builder builder(&state, config);
-  for (size_t i = 0; i < targets.size(); ++i) {
-    if (!builder.AddTarget(targets[i], &err)) {
-      if (!err.empty()) {
-        Error("%s", err.c_str());
-        return 1;
-      } else {
-        // Added a target that is already up-to-date; not really
-        // an error.
-      }
+  if (!options.watch)
+    return RunBuild(&state, config, targets, build_trace);
+
+#ifdef linux
+  // Keep the State around and only re-examine the files that change.
+  Watcher watcher(&state);
+  if (!watcher.Start(&err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  // The manifest and the files it includes needn't be in the graph, so
+  // watch them apart from it.
+  set<string> manifest_paths;
+  for (vector<string>::iterator i = file_reader.paths_.begin();
+       i != file_reader.paths_.end(); ++i) {
+    string path = *i;
+    if (!CanonicalizePath(&path, &err)) {
+      Error("%s", err.c_str());
+      return 1;
     }
+    manifest_paths.insert(path);
+    watcher.WatchFile(path);
   }
+  for (;;) {
+    RunBuild(&state, config, targets, build_trace);
+    // A second Ctrl-C while we wait for changes kills us outright.
+    build_log.Flush();
+    ResetDirtyNodes(&state);
+    watcher.AddWatches();
 
-  if (builder.AlreadyUpToDate()) {
-    printf("ninja: no work to do.\n");
-    return 0;
-  }
+    // Files may have been edited while the build ran; if so, start over
+    // right away.
+    vector<string> changed;
+    if (!watcher.ReadBuildEvents(&changed, &err)) {
+      Error("watching for changes: %s", err.c_str());
+      return 1;
+    }
+    if (changed.empty()) {
+      printf("ninja: waiting for changes...\n");
+      if (!watcher.WaitForChanges(&changed, &err)) {
+        Error("watching for changes: %s", err.c_str());
+        return 1;
+      }
+    }
 
-  if (!builder.Build(&err)) {
-    printf("ninja: build stopped: %s.\n", err.c_str());
-    return 1;
+    for (vector<string>::iterator i = changed.begin(); i != changed.end();
+         ++i) {
+      if (manifest_paths.count(*i)) {
+        rebuilt_manifest = false;
+        goto reload;
+      }
+    }
+    if (RebuildManifest(&state, config, input_file, &err)) {
+      rebuilt_manifest = true;
+      goto reload;
+    } else if (!err.empty()) {
+      Error("rebuilding '%s': %s", input_file, err.c_str());
+      err.clear();
+    }
   }
-
-  return 0;
+#else
+  Error("-w is not supported on this platform");
+  return 1;
+#endif
 }
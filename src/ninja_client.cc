@@ -0,0 +1,54 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ninja_client forwards its command line to a server started with
+// "ninja -t server", which runs it against an already-loaded build.
+// If no server is running, it runs ninja itself instead.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "util.h"
+
+int main(int argc, char** argv) {
+  // A server builds in the directory it was started in, so -C is the only
+  // flag we need to look at to find it.
+  string working_dir;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-C") == 0 && i + 1 < argc)
+      working_dir = argv[++i];
+    else if (strncmp(argv[i], "-C", 2) == 0)
+      working_dir = argv[i] + 2;
+    else if (strcmp(argv[i], "--") == 0 || strncmp(argv[i], "-t", 2) == 0)
+      break;
+  }
+
+  string err;
+  int status = RunClient(working_dir, argc, argv, &err);
+  if (status >= 0) {
+    if (!err.empty())
+      Error("%s", err.c_str());
+    return status;
+  }
+
+  // No server, so do the work ourselves.  This is safe only because the
+  // server never got the request.
+  argv[0] = (char*)"ninja";
+  execvp(argv[0], argv);
+  Fatal("exec ninja: %s", strerror(errno));
+  return 1;
+}
@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "graph.h"
@@ -321,6 +322,9 @@ bool ManifestParser::Parse(const string& input, string* err) {
         if (len == 4 && memcmp(token.pos_, "rule", 4) == 0) {
           if (!ParseRule(err))
             return false;
+        } else if (len == 4 && memcmp(token.pos_, "pool", 4) == 0) {
+          if (!ParsePool(err))
+            return false;
         } else if (len == 5 && memcmp(token.pos_, "build", 5) == 0) {
           if (!ParseEdge(err))
             return false;
@@ -395,6 +399,25 @@ bool ManifestParser::ParseRule(string* err) {
         if (!tokenizer_.ReadToNewline(&dummy, err))
           return false;
         continue;
+      } else if (key == "shell") {
+        rule->shell_ = true;
+        string dummy;
+        if (!tokenizer_.ReadToNewline(&dummy, err))
+          return false;
+        continue;
+      } else if (key == "pool") {
+        EvalString eval;
+        if (!ParseLetValue(&eval, err))
+          return false;
+        string pool_name = eval.Evaluate(env_);
+        if (!pool_name.empty()) {
+          rule->pool_ = state_->LookupPool(pool_name);
+          if (!rule->pool_)
+            return tokenizer_.ErrorAt(let_loc,
+                                      "unknown pool name '" + pool_name + "'",
+                                      err);
+        }
+        continue;
       } else {
         // Die on other keyvals for now; revisit if we want to add a
         // scope here.
@@ -415,6 +438,48 @@ bool ManifestParser::ParseRule(string* err) {
   return true;
 }
 
+bool ManifestParser::ParsePool(string* err) {
+  if (!tokenizer_.ExpectIdent("pool", err))
+    return false;
+  StringPiece name_token;
+  if (!tokenizer_.ReadIdent(&name_token))
+    return tokenizer_.ErrorExpected("pool name", err);
+  string name(name_token.str_, name_token.len_);
+  if (!tokenizer_.Newline(err))
+    return false;
+
+  if (state_->LookupPool(name) != NULL)
+    return tokenizer_.ErrorAt(name_token.str_,
+                              "duplicate pool '" + name + "'", err);
+
+  int depth = -1;
+  if (tokenizer_.PeekToken() == Token::INDENT) {
+    tokenizer_.ConsumeToken();
+
+    while (tokenizer_.PeekToken() != Token::OUTDENT) {
+      const char* let_loc = tokenizer_.token_.pos_;
+
+      string key, value;
+      if (!ParseLet(&key, &value, err))
+        return false;
+      if (key != "depth")
+        return tokenizer_.ErrorAt(let_loc, "unexpected variable '" + key + "'",
+                                  err);
+      char* end;
+      depth = strtol(value.c_str(), &end, 10);
+      if (value.empty() || *end != 0 || depth <= 0)
+        return tokenizer_.ErrorAt(let_loc, "invalid pool depth", err);
+    }
+    tokenizer_.ConsumeToken();
+  }
+
+  if (depth < 0)
+    return tokenizer_.Error("expected 'depth =' line", err);
+
+  state_->AddPool(new Pool(name, depth));
+  return true;
+}
+
 bool ManifestParser::ParseLet(string* key, string* value, string* err) {
   if (!ParseLetKey(key, err))
     return false;
@@ -587,6 +652,20 @@ bool ManifestParser::ParseEdge(string* err) {
 
   Edge* edge = state_->AddEdge(rule);
   edge->env_ = env;
+  if (env != env_) {
+    // The edge's own pool binding overrides the rule's; an empty one
+    // takes the edge out of it.
+    map<string, string>::iterator pool = env->bindings_.find("pool");
+    if (pool != env->bindings_.end()) {
+      edge->pool_ = NULL;
+      if (!pool->second.empty()) {
+        edge->pool_ = state_->LookupPool(pool->second);
+        if (!edge->pool_)
+          return tokenizer_.Error("unknown pool name '" + pool->second + "'",
+                                  err);
+      }
+    }
+  }
   for (vector<string>::iterator i = ins.begin(); i != ins.end(); ++i)
     state_->AddIn(edge, *i);
   for (vector<string>::iterator i = outs.begin(); i != outs.end(); ++i)
@@ -125,6 +125,7 @@ struct ManifestParser {
   bool Parse(const string& input, string* err);
 
   bool ParseRule(string* err);
+  bool ParsePool(string* err);
   /// Parse a key=val statement, expanding $vars in the value with the
   /// current env.
   bool ParseLet(string* key, string* val, string* err);
@@ -64,6 +64,45 @@ TEST_F(ParserTest, Rules) {
   EXPECT_EQ("cat $in > $out", rule->command_.unparsed());
 }
 
+TEST_F(ParserTest, RuleFlags) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"rule direct\n"
+"  command = cp $in $out\n"
+"rule sh\n"
+"  command = cp $in $out\n"
+"  shell = 1\n"));
+
+  EXPECT_FALSE(state.LookupRule("direct")->shell_);
+  EXPECT_TRUE(state.LookupRule("sh")->shell_);
+}
+
+TEST_F(ParserTest, Pools) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"pool link_pool\n"
+"  depth = 4\n"
+"pool migrate\n"
+"  depth = 1\n"
+"rule link\n"
+"  command = ld $in -o $out\n"
+"  pool = link_pool\n"
+"build a: link a.o\n"
+"build b: link b.o\n"
+"  pool = migrate\n"
+"build c: link c.o\n"
+"  pool =\n"
+"build d: phony d.in\n"));
+
+  Pool* link_pool = state.LookupPool("link_pool");
+  ASSERT_TRUE(link_pool);
+  EXPECT_EQ(4, link_pool->depth_);
+  EXPECT_EQ(link_pool, state.LookupRule("link")->pool_);
+  ASSERT_EQ(4u, state.edges_.size());
+  EXPECT_EQ(link_pool, state.edges_[0]->pool_);
+  EXPECT_EQ(state.LookupPool("migrate"), state.edges_[1]->pool_);
+  EXPECT_EQ(NULL, state.edges_[2]->pool_);
+  EXPECT_EQ(NULL, state.edges_[3]->pool_);
+}
+
 TEST_F(ParserTest, Variables) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(
 "l = one-letter-test\n"
@@ -381,6 +420,55 @@ TEST_F(ParserTest, Errors) {
   }
 }
 
+TEST_F(ParserTest, PoolErrors) {
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("pool p\n", &err));
+    EXPECT_EQ("line 2, col 1: expected 'depth =' line", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("pool p\n"
+                              "  depth = 0\n", &err));
+    EXPECT_EQ("line 2, col 3: invalid pool depth", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("pool p\n"
+                              "  size = 2\n", &err));
+    EXPECT_EQ("line 2, col 3: unexpected variable 'size'", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("pool p\n"
+                              "  depth = 1\n"
+                              "pool p\n"
+                              "  depth = 2\n", &err));
+    EXPECT_EQ("line 3, col 6: duplicate pool 'p'", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("rule r\n"
+                              "  command = r\n"
+                              "  pool = nope\n", &err));
+    EXPECT_EQ("line 3, col 3: unknown pool name 'nope'", err);
+  }
+}
+
 TEST_F(ParserTest, MultipleOutputs)
 {
   State state;
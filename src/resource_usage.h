@@ -0,0 +1,50 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_RESOURCE_USAGE_H_
+#define NINJA_RESOURCE_USAGE_H_
+
+#include <stdint.h>
+
+/// What a finished command used of the machine, counting the processes
+/// it ran.  Each figure is 0 if unknown.
+struct ResourceUsage {
+  ResourceUsage()
+      : peak_rss_kb(0), user_time_ms(0), system_time_ms(0),
+        voluntary_switches(0), involuntary_switches(0), read_bytes(0),
+        write_bytes(0) {}
+
+  /// The most memory any one process had resident at once.
+  uint64_t peak_rss_kb;
+  /// CPU time, in user and kernel mode.
+  uint64_t user_time_ms;
+  uint64_t system_time_ms;
+  /// Context switches from waiting (mostly for IO), and from being
+  /// preempted (from contending for a CPU).
+  uint64_t voluntary_switches;
+  uint64_t involuntary_switches;
+  /// Bytes read from and written to storage, rather than the page cache.
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+
+  bool operator==(const ResourceUsage& o) const {
+    return peak_rss_kb == o.peak_rss_kb && user_time_ms == o.user_time_ms &&
+        system_time_ms == o.system_time_ms &&
+        voluntary_switches == o.voluntary_switches &&
+        involuntary_switches == o.involuntary_switches &&
+        read_bytes == o.read_bytes && write_bytes == o.write_bytes;
+  }
+};
+
+#endif  // NINJA_RESOURCE_USAGE_H_
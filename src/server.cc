@@ -0,0 +1,389 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "util.h"
+
+const char kServerSocketPath[] = ".ninja_server";
+
+namespace {
+
+/// Number of file descriptors passed with a request: stdin, stdout, stderr.
+const int kStdioCount = 3;
+
+/// Upper bound on the size of a request, to catch garbage.
+const uint32_t kMaxRequestSize = 16 << 20;
+
+/// Fill in \a addr with the socket path for the server in \a dir.
+bool MakeAddress(const string& dir, sockaddr_un* addr, string* err) {
+  string path = kServerSocketPath;
+  if (!dir.empty())
+    path = dir + "/" + path;
+  if (path.size() >= sizeof(addr->sun_path)) {
+    *err = path + ": path too long for a socket";
+    return false;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path.c_str());
+  return true;
+}
+
+/// Read exactly \a len bytes.  Returns false on error or early EOF.
+bool ReadFully(int fd, char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t ret = read(fd, buf, len);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    buf += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+/// Write exactly \a len bytes to the socket \a fd.  Returns false on
+/// error, including the other end having gone away.
+bool WriteFully(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t ret = send(fd, buf, len, MSG_NOSIGNAL);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0)
+      return false;
+    buf += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+/// How often to interrupt a request again once its client has gone, in
+/// case it wasn't building when the last interrupt came.
+const int kReinterruptMillis = 100;
+
+/// Interrupts the request being handled, the way Ctrl-C would, if its
+/// client closes the connection (or shuts down its side of it, as it does
+/// on Ctrl-C).  The client sends nothing after the request, so the
+/// connection only becomes readable when it does.
+struct HangupWatcher {
+  explicit HangupWatcher(int conn);
+  /// Stop watching.
+  ~HangupWatcher();
+
+ private:
+  static void* Run(void* arg);
+
+  int conn_;
+  pthread_t main_thread_;
+  pthread_t thread_;
+  bool started_;
+  /// Written to when it's time to stop.
+  int stop_pipe_[2];
+  struct sigaction old_int_action_;
+};
+
+HangupWatcher::HangupWatcher(int conn)
+    : conn_(conn), main_thread_(pthread_self()), started_(false) {
+  stop_pipe_[0] = stop_pipe_[1] = -1;
+  // A SIGINT while no commands run would otherwise kill the server; see
+  // Run() for how it's repeated until the build gets it.
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = SIG_IGN;
+  sigaction(SIGINT, &act, &old_int_action_);
+
+  if (pipe(stop_pipe_) < 0) {
+    Warning("server: pipe: %s; Ctrl-C in clients won't stop builds",
+            strerror(errno));
+    return;
+  }
+  SetCloseOnExec(stop_pipe_[0]);
+  SetCloseOnExec(stop_pipe_[1]);
+
+  // Leave SIGINT and SIGTERM to the main thread, where they interrupt
+  // the wait for commands.
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+  started_ = pthread_create(&thread_, NULL, Run, this) == 0;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (!started_) {
+    Warning("server: can't start thread; Ctrl-C in clients won't stop "
+            "builds");
+  }
+}
+
+HangupWatcher::~HangupWatcher() {
+  if (started_) {
+    char stop = 0;
+    while (write(stop_pipe_[1], &stop, 1) < 0 && errno == EINTR) {}
+    pthread_join(thread_, NULL);
+  }
+  if (stop_pipe_[0] >= 0) {
+    close(stop_pipe_[0]);
+    close(stop_pipe_[1]);
+  }
+  sigaction(SIGINT, &old_int_action_, NULL);
+}
+
+void* HangupWatcher::Run(void* arg) {
+  HangupWatcher* watcher = (HangupWatcher*)arg;
+  bool hung_up = false;
+  for (;;) {
+    pollfd fds[2] = {
+      { watcher->stop_pipe_[0], POLLIN, 0 },
+      { watcher->conn_, POLLIN, 0 },
+    };
+    // Once the client is gone, only the stop pipe is of interest.
+    int ret = poll(fds, hung_up ? 1 : 2, hung_up ? kReinterruptMillis : -1);
+    if (ret < 0 && errno != EINTR)
+      return NULL;
+    if (fds[0].revents)
+      return NULL;
+    if (fds[1].revents)
+      hung_up = true;
+    // The build only sees the signal while it waits for commands, and
+    // ignores it otherwise, e.g. while loading the manifest.
+    if (hung_up)
+      pthread_kill(watcher->main_thread_, SIGINT);
+  }
+}
+
+/// The connection of the request RunClient() is waiting for.
+volatile sig_atomic_t client_fd = -1;
+
+/// Tell the server to interrupt the request, the way Ctrl-C would have
+/// if it were running here.
+void ShutDownClientSocket(int signum) {
+  shutdown(client_fd, SHUT_WR);
+}
+
+}  // anonymous namespace
+
+Server::Server(Delegate* delegate) : delegate_(delegate), fd_(-1) {}
+
+Server::~Server() {
+  if (fd_ >= 0) {
+    close(fd_);
+    unlink(kServerSocketPath);
+  }
+}
+
+bool Server::Listen(string* err) {
+  // A client going away mid-request must not take the server with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un addr;
+  if (!MakeAddress("", &addr, err))
+    return false;
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ < 0) {
+    *err = string("socket: ") + strerror(errno);
+    return false;
+  }
+  SetCloseOnExec(fd_);
+
+  // If the socket is left over from a server that died, replace it.
+  if (connect(fd_, (sockaddr*)&addr, sizeof(addr)) == 0) {
+    *err = "a server is already running in this directory";
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  close(fd_);
+  fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ < 0) {
+    *err = string("socket: ") + strerror(errno);
+    return false;
+  }
+  SetCloseOnExec(fd_);
+  unlink(kServerSocketPath);
+
+  if (bind(fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd_, 16) < 0) {
+    *err = string(kServerSocketPath) + ": " + strerror(errno);
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool Server::Serve(string* err) {
+  for (;;) {
+    int conn = accept(fd_, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      *err = string("accept: ") + strerror(errno);
+      return false;
+    }
+    SetCloseOnExec(conn);
+    HandleConnection(conn);
+    close(conn);
+  }
+}
+
+void Server::HandleConnection(int fd) {
+  // The request starts with its size, and carries the client's stdio.
+  uint32_t size;
+  char control[CMSG_SPACE(kStdioCount * sizeof(int))];
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  if (len != sizeof(size))
+    return;
+
+  int stdio[kStdioCount];
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(stdio))) {
+    Error("server: malformed request");
+    return;
+  }
+  memcpy(stdio, CMSG_DATA(cmsg), sizeof(stdio));
+
+  vector<char> buf;
+  vector<char*> args;
+  if (size <= kMaxRequestSize) {
+    buf.resize(size + 1);
+    if (ReadFully(fd, &buf[0], size)) {
+      buf[size] = 0;
+      for (char* arg = &buf[0]; arg < &buf[0] + size;
+           arg += strlen(arg) + 1)
+        args.push_back(arg);
+    }
+  }
+
+  int32_t status = 1;
+  if (!args.empty()) {
+    // Run the request with the client's stdio in place of ours.
+    fflush(stdout);
+    fflush(stderr);
+    int saved[kStdioCount];
+    for (int i = 0; i < kStdioCount; ++i) {
+      saved[i] = dup(i);
+      SetCloseOnExec(saved[i]);
+      dup2(stdio[i], i);
+    }
+
+    args.push_back(NULL);
+    {
+      HangupWatcher watcher(fd);
+      status = delegate_->HandleRequest(args.size() - 1, &args[0]);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < kStdioCount; ++i) {
+      dup2(saved[i], i);
+      close(saved[i]);
+    }
+  } else {
+    Error("server: malformed request");
+  }
+
+  for (int i = 0; i < kStdioCount; ++i)
+    close(stdio[i]);
+  WriteFully(fd, (const char*)&status, sizeof(status));
+}
+
+int RunClient(const string& dir, int argc, char** argv, string* err) {
+  sockaddr_un addr;
+  if (!MakeAddress(dir, &addr, err))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    *err = string("socket: ") + strerror(errno);
+    return -1;
+  }
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    *err = string(addr.sun_path) + ": " + strerror(errno);
+    close(fd);
+    return -1;
+  }
+
+  string request;
+  for (int i = 0; i < argc; ++i) {
+    request.append(argv[i]);
+    request.push_back('\0');
+  }
+  uint32_t size = request.size();
+
+  int stdio[kStdioCount] = { 0, 1, 2 };
+  char control[CMSG_SPACE(sizeof(stdio))];
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(stdio));
+  memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+  int32_t status;
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(size) ||
+      !WriteFully(fd, request.data(), request.size())) {
+    *err = string("sending request: ") + strerror(errno);
+    close(fd);
+    return -1;
+  }
+
+  // The server has the request now, and may have started on it, so
+  // whatever happens the caller mustn't run it again.  Ctrl-C is passed
+  // on; a second one kills us outright.
+  client_fd = fd;
+  struct sigaction act, old_act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = ShutDownClientSocket;
+  act.sa_flags = SA_RESETHAND;
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGINT, &act, &old_act);
+  if (!ReadFully(fd, (char*)&status, sizeof(status))) {
+    *err = "server closed the connection";
+    status = 1;
+  }
+  sigaction(SIGINT, &old_act, NULL);
+  client_fd = -1;
+  close(fd);
+  return status;
+}
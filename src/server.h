@@ -0,0 +1,67 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_SERVER_H_
+#define NINJA_SERVER_H_
+
+#include <string>
+using namespace std;
+
+/// Path of the Unix domain socket a ninja server listens on, relative to
+/// the directory it builds in.
+extern const char kServerSocketPath[];
+
+/// Server accepts requests from ninja_client over a Unix domain socket and
+/// runs them one at a time, in-process, so that state can be kept between
+/// requests.
+///
+/// A request is the client's command-line arguments together with its
+/// stdin, stdout and stderr (passed as file descriptors), which stand in
+/// for the server's own while the request runs.  The reply is the exit
+/// status of the request.  The client closing the connection, or shutting
+/// down its side of it, interrupts the request like Ctrl-C.
+struct Server {
+  struct Delegate {
+    virtual ~Delegate() {}
+    /// Handle a request with the given arguments (argv[0] is the client's
+    /// command name).  Returns the exit status to send to the client.
+    virtual int HandleRequest(int argc, char** argv) = 0;
+  };
+
+  explicit Server(Delegate* delegate);
+  ~Server();
+
+  /// Start listening on kServerSocketPath.  Fills in \a err on error.
+  bool Listen(string* err);
+
+  /// Serve requests until an error occurs.  Fills in \a err.
+  bool Serve(string* err);
+
+ private:
+  /// Handle a single connection.
+  void HandleConnection(int fd);
+
+  Delegate* delegate_;
+  int fd_;
+};
+
+/// Send the arguments and stdio of this process to the server listening in
+/// \a dir (empty for the current directory), and wait for the request to
+/// finish.  SIGINT meanwhile interrupts the request.  Returns the exit
+/// status of the request, or -1 (and fills in \a err) if there's no server
+/// or the request couldn't be sent.  If the connection is lost once the
+/// request was sent, fills in \a err and returns 1.
+int RunClient(const string& dir, int argc, char** argv, string* err);
+
+#endif  // NINJA_SERVER_H_
@@ -0,0 +1,141 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how many trivial commands per second can be started, as the
+// memory in use by the process starting them grows.  Subprocess is
+// compared against starting the same commands with fork() and exec().
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "subprocess.h"
+#include "util.h"
+
+namespace {
+
+const char kCommand[] = "true";
+
+/// Run \a count commands, \a parallelism at a time, through Subprocess.
+void RunSubprocesses(int count, int parallelism) {
+  SubprocessSet subprocs;
+  int started = 0, finished = 0;
+  while (finished < count) {
+    while (started < count && (int)subprocs.running_.size() < parallelism) {
+      Subprocess* subproc = new Subprocess;
+      subproc->Start(&subprocs, kCommand);
+      subprocs.Add(subproc);
+      ++started;
+    }
+    subprocs.DoWork();
+    while (Subprocess* subproc = subprocs.NextFinished()) {
+      if (!subproc->Finish())
+        Fatal("'%s' failed", kCommand);
+      delete subproc;
+      ++finished;
+    }
+  }
+}
+
+/// Run \a count commands, \a parallelism at a time, with fork() and exec().
+void RunForks(int count, int parallelism) {
+  int started = 0, running = 0;
+  while (started < count || running) {
+    while (started < count && running < parallelism) {
+      pid_t pid = fork();
+      if (pid < 0)
+        Fatal("fork: %s", strerror(errno));
+      if (pid == 0) {
+        execl("/bin/sh", "/bin/sh", "-c", kCommand, (char*)NULL);
+        _exit(1);
+      }
+      ++started;
+      ++running;
+    }
+    int status;
+    if (wait(&status) < 0)
+      Fatal("wait: %s", strerror(errno));
+    --running;
+  }
+}
+
+/// Return how many commands per second \a run starts.
+double JobsPerSecond(void (*run)(int, int), int count, int parallelism) {
+  int64_t start = GetTimeMillis();
+  run(count, parallelism);
+  int64_t elapsed = GetTimeMillis() - start;
+  return count * 1000.0 / (elapsed ? elapsed : 1);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int count = 2000;
+  int parallelism = 16;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:j:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'j':
+        parallelism = atoi(optarg);
+        break;
+      default:
+        printf("usage: %s [-n commands] [-j parallelism] [MB...]\n"
+               "Reports commands started per second while the given amounts "
+               "of memory\nare in use [default: 0 256 1024].\n", argv[0]);
+        return 1;
+    }
+  }
+  if (count < 1 || parallelism < 1) {
+    printf("invalid -n or -j\n");
+    return 1;
+  }
+
+  vector<int> sizes;
+  for (int i = optind; i < argc; ++i)
+    sizes.push_back(atoi(argv[i]));
+  if (sizes.empty()) {
+    sizes.push_back(0);
+    sizes.push_back(256);
+    sizes.push_back(1024);
+  }
+
+  printf("%d commands, %d at a time\n", count, parallelism);
+  printf("%8s %12s %12s\n", "rss", "Subprocess", "fork");
+  vector<char*> blocks;
+  int allocated = 0;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    // Grow the memory in use by touching every page of new blocks.
+    for (; allocated < sizes[i]; ++allocated) {
+      char* block = (char*)malloc(1 << 20);
+      if (!block)
+        Fatal("out of memory");
+      memset(block, 1, 1 << 20);
+      blocks.push_back(block);
+    }
+
+    double spawned = JobsPerSecond(RunSubprocesses, count, parallelism);
+    double forked = JobsPerSecond(RunForks, count, parallelism);
+    printf("%6dMB %8.0f/sec %8.0f/sec\n", allocated, spawned, forked);
+  }
+
+  for (size_t i = 0; i < blocks.size(); ++i)
+    free(blocks[i]);
+  return 0;
+}
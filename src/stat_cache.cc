@@ -42,6 +42,8 @@ void StatCache::Dump() {
 void StatCache::Invalidate() {
   for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
     i->second->mtime_ = -1;
-    i->second->node_->dirty_ = false;
+    // LookupNode() may have created a FileStat that no Node refers to.
+    if (i->second->node_)
+      i->second->node_->dirty_ = false;
   }
 }
@@ -21,7 +21,7 @@
 
 const Rule State::kPhonyRule("phony");
 
-State::State() : build_log_(NULL) {
+State::State() : build_log_(NULL), hash_cache_(NULL) {
   AddRule(&kPhonyRule);
 }
 
@@ -37,9 +37,22 @@ const Rule* State::LookupRule(const string& rule_name) {
   return i->second;
 }
 
+void State::AddPool(Pool* pool) {
+  assert(LookupPool(pool->name_) == NULL);
+  pools_[pool->name_] = pool;
+}
+
+Pool* State::LookupPool(const string& pool_name) {
+  map<string, Pool*>::iterator i = pools_.find(pool_name);
+  if (i == pools_.end())
+    return NULL;
+  return i->second;
+}
+
 Edge* State::AddEdge(const Rule* rule) {
   Edge* edge = new Edge();
   edge->rule_ = rule;
+  edge->pool_ = rule->pool_;
   edge->env_ = &bindings_;
   edges_.push_back(edge);
   return edge;
@@ -110,5 +123,21 @@ vector<Node*> State::DefaultNodes(string* err) {
 void State::Reset() {
   stat_cache_.Invalidate();
   for (vector<Edge*>::iterator e = edges_.begin(); e != edges_.end(); ++e)
-    (*e)->outputs_ready_ = false;
+    (*e)->outputs_ready_ = (*e)->depfile_loaded_ = false;
+}
+
+void State::ResetNode(Node* node) {
+  node->file_->mtime_ = -1;
+  node->dirty_ = false;
+  for (vector<Edge*>::iterator e = node->out_edges_.begin();
+       e != node->out_edges_.end(); ++e) {
+    (*e)->outputs_ready_ = (*e)->depfile_loaded_ = false;
+    for (vector<Node*>::iterator out = (*e)->outputs_.begin();
+         out != (*e)->outputs_.end(); ++out) {
+      // Outputs whose status is unknown have already been reset (or were
+      // never scanned), and so have their dependents.
+      if ((*out)->file_->status_known())
+        ResetNode(*out);
+    }
+  }
 }
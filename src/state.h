@@ -30,6 +30,15 @@ struct Edge;
 struct Node;
 struct Rule;
 
+/// A pool declared in the manifest: at most depth_ of the edges in it run
+/// at once, whatever the -j.  See Plan for how edges wait their turn.
+struct Pool {
+  Pool(const string& name, int depth) : name_(name), depth_(depth) {}
+
+  string name_;
+  int depth_;
+};
+
 /// Global state (file status, loaded rules) for a single run.
 struct State {
   static const Rule kPhonyRule;
@@ -38,6 +47,8 @@ struct State {
 
   void AddRule(const Rule* rule);
   const Rule* LookupRule(const string& rule_name);
+  void AddPool(Pool* pool);
+  Pool* LookupPool(const string& pool_name);
   Edge* AddEdge(const Rule* rule);
   Node* GetNode(const string& path);
   Node* LookupNode(const string& path);
@@ -46,6 +57,11 @@ struct State {
   bool AddDefault(const string& path, string* error);
   void Reset();
 
+  /// Forget the status of \a node and of everything built from it, so that
+  /// the next scan re-examines only those.  Used when a file is known to
+  /// have changed in a State that is kept across builds.
+  void ResetNode(Node* node);
+
   /// @return the root node(s) of the graph. (Root nodes have no output edges).
   /// @param error where to write the error message if somethings went wrong.
   vector<Node*> RootNodes(string* error);
@@ -58,12 +74,17 @@ struct State {
   /// All the rules used in the graph.
   map<string, const Rule*> rules_;
 
+  /// All the pools declared in the manifest.
+  map<string, Pool*> pools_;
+
   /// All the edges of the graph.
   vector<Edge*> edges_;
 
   BindingEnv bindings_;
   vector<Node*> defaults_;
   struct BuildLog* build_log_;
+  /// Content hashes of files; NULL unless the manifest sets content_hash.
+  struct HashCache* hash_cache_;
 };
 
 #endif  // NINJA_STATE_H_
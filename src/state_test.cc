@@ -38,4 +38,33 @@ TEST(State, Basic) {
   EXPECT_FALSE(state.GetNode("out")->dirty());
 }
 
+TEST(State, ResetNode) {
+  State state;
+  Rule* rule = new Rule("cat");
+  string err;
+  EXPECT_TRUE(rule->ParseCommand("cat $in > $out", &err));
+  state.AddRule(rule);
+  Edge* edge1 = state.AddEdge(rule);
+  state.AddIn(edge1, "in1");
+  state.AddOut(edge1, "mid");
+  Edge* edge2 = state.AddEdge(rule);
+  state.AddIn(edge2, "mid");
+  state.AddIn(edge2, "in2");
+  state.AddOut(edge2, "out");
+
+  const char* kPaths[] = { "in1", "in2", "mid", "out" };
+  for (int i = 0; i < 4; ++i)
+    state.GetNode(kPaths[i])->file_->mtime_ = 1;
+  edge1->outputs_ready_ = edge2->outputs_ready_ = true;
+
+  // Resetting in1 should reset everything built from it, but not in2.
+  state.ResetNode(state.GetNode("in1"));
+  EXPECT_FALSE(state.GetNode("in1")->file_->status_known());
+  EXPECT_FALSE(state.GetNode("mid")->file_->status_known());
+  EXPECT_FALSE(state.GetNode("out")->file_->status_known());
+  EXPECT_TRUE(state.GetNode("in2")->file_->status_known());
+  EXPECT_FALSE(edge1->outputs_ready());
+  EXPECT_FALSE(edge2->outputs_ready());
+}
+
 }  // namespace
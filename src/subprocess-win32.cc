@@ -43,7 +43,7 @@ void Win32Fatal(const char* function) {
 
 }  // anonymous namespace
 
-Subprocess::Subprocess() : child_(NULL) , overlapped_() {
+Subprocess::Subprocess() : output_limit_(0), child_(NULL) , overlapped_() {
 }
 
 Subprocess::~Subprocess() {
@@ -88,7 +88,10 @@ HANDLE Subprocess::SetupPipe(HANDLE ioport) {
   return output_write_child;
 }
 
-bool Subprocess::Start(SubprocessSet* set, const string& command) {
+bool Subprocess::Start(SubprocessSet* set, const string& command,
+                       bool force_shell) {
+  // Commands are always run directly; there's no shell in the way.
+  output_limit_ = set->output_limit_;
   HANDLE child_pipe = SetupPipe(set->ioport_);
 
   STARTUPINFOA startup_info = {};
@@ -133,7 +136,7 @@ void Subprocess::OnPipeReady() {
   }
 
   if (bytes)
-    buf_.append(overlapped_buf_, bytes);
+    output_.Append(overlapped_buf_, bytes, output_limit_);
 
   memset(&overlapped_, 0, sizeof(overlapped_));
   if (!::ReadFile(pipe_, overlapped_buf_, sizeof(overlapped_buf_),
@@ -169,10 +172,14 @@ bool Subprocess::Done() const {
 }
 
 const string& Subprocess::GetOutput() const {
-  return buf_;
+  return output_.text();
 }
 
-SubprocessSet::SubprocessSet() {
+void Subprocess::TakeOutput(CommandOutput* output) {
+  output_.Swap(output);
+}
+
+SubprocessSet::SubprocessSet() : output_limit_((size_t)-1) {
   ioport_ = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
   if (!ioport_)
     Win32Fatal("CreateIoCompletionPort");
@@ -186,7 +193,7 @@ void SubprocessSet::Add(Subprocess* subprocess) {
   running_.push_back(subprocess);
 }
 
-void SubprocessSet::DoWork() {
+bool SubprocessSet::DoWork() {
   DWORD bytes_read;
   Subprocess* subproc;
   OVERLAPPED* overlapped;
@@ -207,6 +214,7 @@ void SubprocessSet::DoWork() {
       running_.resize(end - running_.begin());
     }
   }
+  return false;
 }
 
 Subprocess* SubprocessSet::NextFinished() {
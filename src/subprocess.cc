@@ -15,96 +15,279 @@
 #include "subprocess.h"
 
 #include <algorithm>
-#include <map>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/select.h>
 #include <sys/wait.h>
+#ifdef linux
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
 
 #include "util.h"
 
-Subprocess::Subprocess() : fd_(-1), pid_(-1) {
+extern char** environ;
+
+namespace {
+
+uint64_t Milliseconds(const struct timeval& time) {
+  return (uint64_t)time.tv_sec * 1000 + time.tv_usec / 1000;
+}
+
+/// Fill in \a usage from \a rusage.
+void SetUsage(const struct rusage& rusage, ResourceUsage* usage) {
+#ifdef __APPLE__
+  usage->peak_rss_kb = rusage.ru_maxrss / 1024;  // In bytes.
+#else
+  usage->peak_rss_kb = rusage.ru_maxrss;
+#endif
+  usage->user_time_ms = Milliseconds(rusage.ru_utime);
+  usage->system_time_ms = Milliseconds(rusage.ru_stime);
+  usage->voluntary_switches = rusage.ru_nvcsw;
+  usage->involuntary_switches = rusage.ru_nivcsw;
+}
+
+/// Fill in the IO of \a usage from /proc/<pid>/io, if there is one.  It
+/// must be read after \a pid exits but before it is reaped, when it
+/// counts the processes that \a pid reaped in turn.
+void ReadProcessIO(pid_t pid, ResourceUsage* usage) {
+#ifdef linux
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+  string io, err;
+  if (ReadFile(path, &io, &err) < 0)
+    return;
+  const char kRead[] = "\nread_bytes:";
+  const char kWrite[] = "\nwrite_bytes:";
+  size_t pos = io.find(kRead);
+  if (pos != string::npos)
+    usage->read_bytes = strtoull(io.c_str() + pos + strlen(kRead), NULL, 10);
+  pos = io.find(kWrite);
+  if (pos != string::npos)
+    usage->write_bytes = strtoull(io.c_str() + pos + strlen(kWrite), NULL, 10);
+#endif
+}
+
+/// Characters that mean something to the shell: operators, quoting,
+/// expansions, globs, comments, and reserved words.
+const char kShellChars[] = "|&;<>()$`\\\"'\t\n*?[]#~{}!";
+
+/// Shell builtins and keywords.  Builtins that have programs of the
+/// same name, like echo and test, are left to the programs.
+const char* const kShellWords[] = {
+  ".", ":", "alias", "bg", "break", "case", "cd", "command", "continue",
+  "do", "done", "elif", "else", "esac", "eval", "exec", "exit", "export",
+  "fc", "fg", "fi", "for", "function", "getopts", "hash", "if", "in",
+  "jobs", "local", "read", "readonly", "return", "select", "set", "shift",
+  "source", "then", "time", "times", "trap", "type", "ulimit", "umask",
+  "unalias", "unset", "until", "wait", "while",
+};
+
+}  // namespace
+
+bool SplitSimpleCommand(const string& command, vector<string>* args) {
+  args->clear();
+  size_t start = 0;
+  for (;;) {
+    start = command.find_first_not_of(' ', start);
+    if (start == string::npos)
+      break;
+    size_t end = command.find(' ', start);
+    if (end == string::npos)
+      end = command.size();
+    string arg = command.substr(start, end - start);
+    if (arg.find_first_of(kShellChars) != string::npos)
+      return false;
+    args->push_back(arg);
+    start = end;
+  }
+  if (args->empty())
+    return false;
+
+  // A first word with '=' is a variable assignment.
+  const string& program = (*args)[0];
+  if (program.find('=') != string::npos)
+    return false;
+  for (size_t i = 0; i < sizeof(kShellWords) / sizeof(kShellWords[0]); ++i) {
+    if (program == kShellWords[i])
+      return false;
+  }
+  return true;
+}
+
+Subprocess::Subprocess()
+    : output_limit_(0), fd_(-1), pid_(-1), pidfd_(-1), exited_(false),
+      status_(0), set_(NULL), running_index_(0) {
 }
 Subprocess::~Subprocess() {
   if (fd_ >= 0)
-    close(fd_);
+    CloseFd(&fd_);
+  if (pidfd_ >= 0)
+    CloseFd(&pidfd_);
   // Reap child if forgotten.
   if (pid_ != -1)
     Finish();
 }
 
-bool Subprocess::Start(SubprocessSet* set, const string& command) {
+bool Subprocess::Start(SubprocessSet* set, const string& command,
+                       bool force_shell) {
+  output_limit_ = set->output_limit_;
   int output_pipe[2];
   if (pipe(output_pipe) < 0)
     Fatal("pipe: %s", strerror(errno));
   fd_ = output_pipe[0];
   SetCloseOnExec(fd_);
+  // The child gets the write end as stdout and stderr, which dup2() leaves
+  // open across exec; the original shouldn't leak into it or other
+  // children.
+  SetCloseOnExec(output_pipe[1]);
 
-  pid_ = fork();
-  if (pid_ < 0)
-    Fatal("fork: %s", strerror(errno));
-
-  if (pid_ == 0) {
-    close(output_pipe[0]);
-
-    // Track which fd we use to report errors on.
-    int error_pipe = output_pipe[1];
-    do {
-      // Open /dev/null over stdin.
-      int devnull = open("/dev/null", O_WRONLY);
-      if (devnull < 0)
-        break;
-      if (dup2(devnull, 0) < 0)
-        break;
-      close(devnull);
-
-      if (dup2(output_pipe[1], 1) < 0 ||
-          dup2(output_pipe[1], 2) < 0)
-        break;
-
-      // Now can use stderr for errors.
-      error_pipe = 2;
-      close(output_pipe[1]);
-
-      execl("/bin/sh", "/bin/sh", "-c", command.c_str(), (char *) NULL);
-    } while (false);
-
-    // If we get here, something went wrong; the execl should have
-    // replaced us.
-    char* err = strerror(errno);
-    if (write(error_pipe, err, strlen(err)) < 0) {
-      // If the write fails, there's nothing we can do.
-      // But this block seems necessary to silence the warning.
-    }
-    _exit(1);
+  // posix_spawn() doesn't copy our page tables the way fork() does, which
+  // gets slow when ninja has a large graph in memory.
+  posix_spawn_file_actions_t actions;
+  int err = posix_spawn_file_actions_init(&actions);
+  if (err == 0) {
+    err = posix_spawn_file_actions_addopen(&actions, 0, "/dev/null",
+                                           O_RDONLY, 0);
+  }
+  if (err == 0)
+    err = posix_spawn_file_actions_adddup2(&actions, output_pipe[1], 1);
+  if (err == 0)
+    err = posix_spawn_file_actions_adddup2(&actions, output_pipe[1], 2);
+  if (err != 0)
+    Fatal("posix_spawn_file_actions: %s", strerror(err));
+  // The set blocks SIGINT and SIGTERM; commands shouldn't inherit that.
+  // Each command gets a process group of its own, so that an interrupt
+  // can be passed on to everything it started; see ~SubprocessSet().
+  posix_spawnattr_t attr;
+  err = posix_spawnattr_init(&attr);
+  if (err == 0)
+    err = posix_spawnattr_setsigmask(&attr, &set->old_mask_);
+  if (err == 0)
+    err = posix_spawnattr_setpgroup(&attr, 0);
+  if (err == 0) {
+    err = posix_spawnattr_setflags(&attr,
+                                   POSIX_SPAWN_SETSIGMASK |
+                                   POSIX_SPAWN_SETPGROUP);
+  }
+  if (err != 0)
+    Fatal("posix_spawnattr: %s", strerror(err));
+
+  // Running a simple command directly saves starting a shell.  If that
+  // fails, e.g. because the program isn't found, the shell runs it and
+  // reports the error the way it always does.
+  err = -1;
+  vector<string> args;
+  if (!force_shell && SplitSimpleCommand(command, &args)) {
+    vector<char*> argv;
+    for (vector<string>::iterator i = args.begin(); i != args.end(); ++i)
+      argv.push_back(const_cast<char*>(i->c_str()));
+    argv.push_back(NULL);
+    err = posix_spawnp(&pid_, argv[0], &actions, &attr, &argv[0], environ);
+  }
+  if (err != 0) {
+    const char* argv[] = { "/bin/sh", "-c", command.c_str(), NULL };
+    err = posix_spawn(&pid_, "/bin/sh", &actions, &attr,
+                      const_cast<char**>(argv), environ);
   }
+  if (err != 0)
+    Fatal("posix_spawn: %s", strerror(err));
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+#if defined(linux) && defined(SYS_pidfd_open)
+  // Without pidfds (before Linux 5.3), Finish() waits for the exit.
+  pidfd_ = syscall(SYS_pidfd_open, pid_, 0);
+#endif
 
   close(output_pipe[1]);
   return true;
 }
 
 void Subprocess::OnPipeReady() {
-  char buf[4 << 10];
+#ifdef linux
+  if (output_.spilled()) {
+    // Move output past the limit from the pipe to the spill file without
+    // copying it through our memory.
+    ssize_t len = splice(fd_, NULL, output_.SpillFd(), NULL, 1 << 20,
+                         SPLICE_F_MOVE);
+    if (len > 0)
+      return;
+    if (len == 0) {
+      CloseFd(&fd_);
+      return;
+    }
+    // The temporary directory may not support splice(); fall back to
+    // read().
+    if (errno != EINVAL)
+      Fatal("splice: %s", strerror(errno));
+  }
+#endif
+
+  // As much as a pipe holds by default.
+  char buf[64 << 10];
   ssize_t len = read(fd_, buf, sizeof(buf));
   if (len > 0) {
-    buf_.append(buf, len);
+    output_.Append(buf, len, output_limit_);
   } else {
     if (len < 0)
       Fatal("read: %s", strerror(errno));
-    close(fd_);
-    fd_ = -1;
+    CloseFd(&fd_);
   }
 }
 
+void Subprocess::OnProcessExit() {
+  // The pidfd is readable once the command has exited, and it can't be
+  // reaped by anyone else meanwhile.
+  ReadProcessIO(pid_, &usage_);
+  struct rusage rusage;
+  pid_t ret = wait4(pid_, &status_, WNOHANG, &rusage);
+  if (ret < 0)
+    Fatal("wait4(%d): %s", pid_, strerror(errno));
+  if (ret == 0)
+    return;  // Not yet.
+  exited_ = true;
+  SetUsage(rusage, &usage_);
+  CloseFd(&pidfd_);
+}
+
+void Subprocess::CloseFd(int* fd) {
+#ifdef linux
+  // A command being started at the same time may briefly hold a copy of
+  // the fd, which would keep it registered after we close it.
+  if (set_)
+    epoll_ctl(set_->epoll_fd_, EPOLL_CTL_DEL, *fd, NULL);
+#endif
+  close(*fd);
+  *fd = -1;
+}
+
 bool Subprocess::Finish() {
   assert(pid_ != -1);
-  int status;
-  if (waitpid(pid_, &status, 0) < 0)
-    Fatal("waitpid(%d): %s", pid_, strerror(errno));
+  int status = status_;
+  if (!exited_) {
+#ifdef linux
+    // Wait without reaping, to read the command's IO first.
+    siginfo_t info;
+    while (waitid(P_PID, pid_, &info, WEXITED | WNOWAIT) < 0) {
+      if (errno != EINTR)
+        Fatal("waitid(%d): %s", pid_, strerror(errno));
+    }
+    ReadProcessIO(pid_, &usage_);
+#endif
+    struct rusage rusage;
+    if (wait4(pid_, &status, 0, &rusage) < 0)
+      Fatal("wait4(%d): %s", pid_, strerror(errno));
+    SetUsage(rusage, &usage_);
+  }
   pid_ = -1;
 
   if (WIFEXITED(status)) {
@@ -116,56 +299,178 @@ bool Subprocess::Finish() {
 }
 
 bool Subprocess::Done() const {
-  return fd_ == -1;
+  return fd_ == -1 && pidfd_ == -1;
 }
 
 const string& Subprocess::GetOutput() const {
-  return buf_;
+  return output_.text();
+}
+
+void Subprocess::TakeOutput(CommandOutput* output) {
+  output_.Swap(output);
 }
 
-SubprocessSet::SubprocessSet() {}
-SubprocessSet::~SubprocessSet() {}
+namespace {
+
+volatile sig_atomic_t interrupted = 0;
+
+void SetInterruptedFlag(int signum) {
+  interrupted = 1;
+}
+
+}  // namespace
+
+SubprocessSet::SubprocessSet() : output_limit_((size_t)-1) {
+  interrupted = 0;
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = SetInterruptedFlag;
+  sigemptyset(&act.sa_mask);
+  // Only let the signals in while DoWork() waits, so that one can't slip
+  // in between checking the flag and starting the wait.
+  sigset_t block;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  if (sigprocmask(SIG_BLOCK, &block, &old_mask_) < 0)
+    Fatal("sigprocmask: %s", strerror(errno));
+  wait_mask_ = old_mask_;
+  sigdelset(&wait_mask_, SIGINT);
+  sigdelset(&wait_mask_, SIGTERM);
+  if (sigaction(SIGINT, &act, &old_int_action_) < 0 ||
+      sigaction(SIGTERM, &act, &old_term_action_) < 0)
+    Fatal("sigaction: %s", strerror(errno));
+#ifdef linux
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    Fatal("epoll_create1: %s", strerror(errno));
+#endif
+}
+
+SubprocessSet::~SubprocessSet() {
+  // Commands run in process groups of their own, so a Ctrl-C in the
+  // terminal only reaches us; pass it on to everything each command
+  // started, e.g. the programs a shell runs.  A command already reaped
+  // through its pidfd may only be waiting for its output to close, and
+  // its pid may belong to another process by now.
+  if (interrupted) {
+    for (vector<Subprocess*>::iterator i = running_.begin();
+         i != running_.end(); ++i) {
+      if (!(*i)->exited_)
+        kill(-(*i)->pid_, SIGINT);
+    }
+  }
+  sigaction(SIGINT, &old_int_action_, NULL);
+  sigaction(SIGTERM, &old_term_action_, NULL);
+  sigprocmask(SIG_SETMASK, &old_mask_, NULL);
+#ifdef linux
+  close(epoll_fd_);
+#endif
+}
 
 void SubprocessSet::Add(Subprocess* subprocess) {
+  subprocess->set_ = this;
+  subprocess->running_index_ = running_.size();
   running_.push_back(subprocess);
+#ifdef linux
+  int fds[] = { subprocess->fd_, subprocess->pidfd_ };
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+    int fd = fds[i];
+    if (fd < 0)
+      continue;
+    if ((size_t)fd >= fd_owners_.size())
+      fd_owners_.resize(fd + 1);
+    fd_owners_[fd] = subprocess;
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0)
+      Fatal("epoll_ctl: %s", strerror(errno));
+  }
+#endif
+}
+
+void SubprocessSet::Remove(Subprocess* subprocess) {
+  Subprocess* last = running_.back();
+  running_[subprocess->running_index_] = last;
+  last->running_index_ = subprocess->running_index_;
+  running_.pop_back();
 }
 
-void SubprocessSet::DoWork() {
-  vector<pollfd> fds;
+#ifdef linux
+bool SubprocessSet::DoWork() {
+  if (interrupted)
+    return true;
+
+  // Room for an event from every fd, so one call reports all that's ready.
+  events_.resize(max((size_t)1, 2 * running_.size()));
+  int ret = epoll_pwait(epoll_fd_, &events_[0], events_.size(), -1,
+                        &wait_mask_);
+  if (ret == -1) {
+    if (errno != EINTR)
+      perror("ninja: epoll_pwait");
+    return interrupted;
+  }
+
+  for (int i = 0; i < ret; ++i) {
+    int fd = events_[i].data.fd;
+    Subprocess* subproc = fd_owners_[fd];
+    if (fd == subproc->fd_)
+      subproc->OnPipeReady();
+    else
+      subproc->OnProcessExit();
+    if (subproc->Done()) {
+      finished_.push(subproc);
+      Remove(subproc);
+    }
+  }
+  return interrupted;
+}
+#else
+
+bool SubprocessSet::DoWork() {
+  fd_set set;
+  int nfds = 0;
+  FD_ZERO(&set);
 
-  map<int, Subprocess*> fd_to_subprocess;
   for (vector<Subprocess*>::iterator i = running_.begin();
        i != running_.end(); ++i) {
     int fd = (*i)->fd_;
     if (fd >= 0) {
-      fd_to_subprocess[fd] = *i;
-      fds.resize(fds.size() + 1);
-      pollfd* newfd = &fds.back();
-      newfd->fd = fd;
-      newfd->events = POLLIN;
-      newfd->revents = 0;
+      FD_SET(fd, &set);
+      if (nfds < fd + 1)
+        nfds = fd + 1;
     }
   }
 
-  int ret = poll(&fds.front(), fds.size(), -1);
+  if (interrupted)
+    return true;
+  int ret = pselect(nfds, &set, NULL, NULL, NULL, &wait_mask_);
   if (ret == -1) {
     if (errno != EINTR)
-      perror("ninja: poll");
-    return;
+      perror("ninja: pselect");
+    return interrupted;
   }
 
-  for (size_t i = 0; i < fds.size(); ++i) {
-    if (fds[i].revents) {
-      Subprocess* subproc = fd_to_subprocess[fds[i].fd];
+  for (vector<Subprocess*>::iterator i = running_.begin();
+       i != running_.end(); ) {
+    Subprocess* subproc = *i;
+    int fd = subproc->fd_;
+    if (fd >= 0 && FD_ISSET(fd, &set)) {
       subproc->OnPipeReady();
       if (subproc->Done()) {
         finished_.push(subproc);
-        std::remove(running_.begin(), running_.end(), subproc);
-        running_.resize(running_.size() - 1);
+        // Remove() moves the last subprocess into this slot.
+        Remove(subproc);
+        continue;
       }
     }
+    ++i;
   }
+  return interrupted;
 }
+#endif  // linux
 
 Subprocess* SubprocessSet::NextFinished() {
   if (finished_.empty())
@@ -22,8 +22,16 @@ using namespace std;
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <signal.h>
+#endif
+#ifdef linux
+#include <sys/epoll.h>
 #endif
 
+#include "command_output.h"
+#include "resource_usage.h"
+
 /// Subprocess wraps a single async subprocess.  It is entirely
 /// passive: it expects the caller to notify it when its fds are ready
 /// for reading, as well as call Finish() to reap the child once done()
@@ -31,17 +39,31 @@ using namespace std;
 struct Subprocess {
   Subprocess();
   ~Subprocess();
-  bool Start(struct SubprocessSet* set, const string& command);
+  /// Start \a command.  On POSIX systems commands simple enough not to
+  /// need a shell (see SplitSimpleCommand()) are run directly rather than
+  /// with /bin/sh, unless \a force_shell.
+  bool Start(struct SubprocessSet* set, const string& command,
+             bool force_shell = false);
   void OnPipeReady();
   /// Returns true on successful process exit.
   bool Finish();
 
   bool Done() const;
 
+  /// The output kept in memory: all of it, unless it spilled past the
+  /// set's output_limit_.
   const string& GetOutput() const;
+  /// Move all of the output into \a output.
+  void TakeOutput(CommandOutput* output);
+
+  /// What the command used, once Finish() has returned.
+  const ResourceUsage& usage() const { return usage_; }
 
  private:
-  string buf_;
+  CommandOutput output_;
+  ResourceUsage usage_;
+  /// The amount of output to keep in memory, from the set.
+  size_t output_limit_;
 
 #ifdef _WIN32
   /// Set up pipe_ as the parent-side pipe of the subprocess; return the
@@ -51,31 +73,84 @@ struct Subprocess {
   HANDLE child_;
   HANDLE pipe_;
   OVERLAPPED overlapped_;
-  char overlapped_buf_[4 << 10];
+  char overlapped_buf_[64 << 10];
 #else
+  /// Collect the exit status once pidfd_ is readable.
+  void OnProcessExit();
+  /// Stop watching \a fd, close it and set it to -1.
+  void CloseFd(int* fd);
+
   int fd_;
   pid_t pid_;
+  /// A pidfd that becomes readable when the command exits, on kernels
+  /// that have them; -1 once the exit status has been collected.
+  int pidfd_;
+  /// Whether the exit status is in status_, collected through pidfd_.
+  bool exited_;
+  int status_;
+  /// The set we were added to, and our index in its running_.
+  struct SubprocessSet* set_;
+  size_t running_index_;
 #endif
 
   friend struct SubprocessSet;
 };
 
-/// SubprocessSet runs a poll() loop around a set of Subprocesses.
+#ifndef _WIN32
+/// Split \a command into \a args if /bin/sh would run it as a single
+/// program with those arguments: if it has no quoting, expansions,
+/// redirections or other shell syntax, and doesn't start with a shell
+/// builtin or keyword.  Returns false if it needs a shell.
+bool SplitSimpleCommand(const string& command, vector<string>* args);
+#endif
+
+/// SubprocessSet runs a pselect() loop around a set of Subprocesses.
 /// DoWork() waits for any state change in subprocesses; finished_
 /// is a queue of subprocesses as they finish.
+///
+/// On Linux the loop uses epoll, with the fds of each subprocess
+/// registered once, and reaps commands through pidfds as they exit, so
+/// the work per command doesn't grow with the number running.
+///
+/// On POSIX systems, while a SubprocessSet exists, SIGINT and SIGTERM
+/// interrupt DoWork() rather than killing ninja, so that it can stop
+/// cleanly.  They are blocked except while DoWork() waits, so one that
+/// arrives just before the wait still ends it.
 struct SubprocessSet {
   SubprocessSet();
   ~SubprocessSet();
 
   void Add(Subprocess* subprocess);
-  void DoWork();
+  /// Returns true if we were interrupted by a signal instead.
+  bool DoWork();
   Subprocess* NextFinished();
 
   vector<Subprocess*> running_;
   queue<Subprocess*> finished_;
 
+  /// The amount of each command's output to keep in memory before
+  /// spilling the rest to disk.  Unlimited by default.
+  size_t output_limit_;
+
 #ifdef _WIN32
   HANDLE ioport_;
+#else
+  /// Stop watching \a subprocess, which has finished.
+  void Remove(Subprocess* subprocess);
+
+  struct sigaction old_int_action_;
+  struct sigaction old_term_action_;
+  /// The signal mask from before SIGINT and SIGTERM were blocked, which
+  /// commands are started with.
+  sigset_t old_mask_;
+  /// old_mask_ without SIGINT and SIGTERM, to wait with.
+  sigset_t wait_mask_;
+#endif
+#ifdef linux
+  int epoll_fd_;
+  /// The subprocess owning each registered fd, by fd.
+  vector<Subprocess*> fd_owners_;
+  vector<epoll_event> events_;
 #endif
 };
 
@@ -100,3 +100,148 @@ TEST_F(SubprocessTest, SetWithMulti) {
   }
 }
 
+
+#ifndef _WIN32
+// Commands read stdin from /dev/null, and write stdout and stderr to the
+// same pipe.
+TEST_F(SubprocessTest, Redirections) {
+  Subprocess* subproc = new Subprocess;
+  EXPECT_TRUE(subproc->Start(&subprocs_, "cat && echo out && echo err >&2"));
+  subprocs_.Add(subproc);
+
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_TRUE(subproc->Finish());
+  EXPECT_EQ("out\nerr\n", subproc->GetOutput());
+  delete subproc;
+}
+#endif
+
+// Finishing commands in any order leaves the others running.
+TEST_F(SubprocessTest, SetWithLots) {
+  const size_t kCount = 100;
+  vector<Subprocess*> processes;
+  for (size_t i = 0; i < kCount; ++i) {
+    Subprocess* subproc = new Subprocess;
+#ifdef _WIN32
+    ASSERT_TRUE(subproc->Start(&subprocs_, "cmd /c echo hi"));
+#else
+    ASSERT_TRUE(subproc->Start(&subprocs_, "echo hi"));
+#endif
+    subprocs_.Add(subproc);
+    processes.push_back(subproc);
+  }
+  while (!subprocs_.running_.empty())
+    subprocs_.DoWork();
+
+  ASSERT_EQ(kCount, subprocs_.finished_.size());
+  for (size_t i = 0; i < processes.size(); ++i) {
+    ASSERT_TRUE(processes[i]->Finish());
+    ASSERT_NE("", processes[i]->GetOutput());
+    delete processes[i];
+  }
+}
+
+#ifndef _WIN32
+TEST(SplitSimpleCommand, Simple) {
+  vector<string> args;
+  EXPECT_TRUE(SplitSimpleCommand("  cc -c  foo.c -DX=1 -o foo.o", &args));
+  ASSERT_EQ(6u, args.size());
+  EXPECT_EQ("cc", args[0]);
+  EXPECT_EQ("-c", args[1]);
+  EXPECT_EQ("foo.c", args[2]);
+  EXPECT_EQ("-DX=1", args[3]);
+  EXPECT_EQ("foo.o", args[5]);
+}
+
+TEST(SplitSimpleCommand, NeedsShell) {
+  vector<string> args;
+  EXPECT_FALSE(SplitSimpleCommand("", &args));
+  EXPECT_FALSE(SplitSimpleCommand("cat in > out", &args));
+  EXPECT_FALSE(SplitSimpleCommand("a && b", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo $HOME", &args));
+  EXPECT_FALSE(SplitSimpleCommand("echo 'a b'", &args));
+  EXPECT_FALSE(SplitSimpleCommand("rm *.o", &args));
+  EXPECT_FALSE(SplitSimpleCommand("ls ~", &args));
+  EXPECT_FALSE(SplitSimpleCommand("CC=gcc make", &args));
+  EXPECT_FALSE(SplitSimpleCommand("cd dir", &args));
+  EXPECT_FALSE(SplitSimpleCommand("exec cc", &args));
+}
+
+// Commands run directly or with the shell give the same results.
+TEST_F(SubprocessTest, DirectAndShell) {
+  const char* kCommands[] = { "echo a  b", "false", "ninja_no_such_command" };
+  for (size_t i = 0; i < sizeof(kCommands) / sizeof(kCommands[0]); ++i) {
+    Subprocess direct, shell;
+    EXPECT_TRUE(direct.Start(&subprocs_, kCommands[i]));
+    subprocs_.Add(&direct);
+    EXPECT_TRUE(shell.Start(&subprocs_, kCommands[i], true));
+    subprocs_.Add(&shell);
+    while (!subprocs_.running_.empty())
+      subprocs_.DoWork();
+    while (subprocs_.NextFinished()) {}
+
+    EXPECT_EQ(shell.Finish(), direct.Finish()) << kCommands[i];
+    EXPECT_EQ(shell.GetOutput(), direct.GetOutput()) << kCommands[i];
+  }
+}
+
+// Output past the set's limit spills to disk, and comes back in full.
+TEST_F(SubprocessTest, OutputLimit) {
+  const char* kCommand = "seq 1 20000";
+  Subprocess all;
+  EXPECT_TRUE(all.Start(&subprocs_, kCommand));
+  subprocs_.Add(&all);
+  while (!all.Done())
+    subprocs_.DoWork();
+  EXPECT_TRUE(all.Finish());
+  ASSERT_GT(all.GetOutput().size(), 100000u);
+
+  subprocs_.output_limit_ = 1000;
+  Subprocess limited;
+  EXPECT_TRUE(limited.Start(&subprocs_, kCommand));
+  subprocs_.Add(&limited);
+  while (!limited.Done())
+    subprocs_.DoWork();
+  EXPECT_TRUE(limited.Finish());
+  EXPECT_LE(limited.GetOutput().size(), 1000u);
+
+  CommandOutput output;
+  limited.TakeOutput(&output);
+  ASSERT_TRUE(output.spilled());
+  FILE* f = tmpfile();
+  output.Print(f);
+  rewind(f);
+  string printed;
+  char buf[4096];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    printed.append(buf, len);
+  fclose(f);
+  EXPECT_EQ(all.GetOutput(), printed);
+}
+
+#ifdef linux
+// SIGINT and SIGTERM are held until DoWork() waits, so that one arriving
+// just before the wait still ends it.  Commands don't inherit that.
+TEST_F(SubprocessTest, SignalsBlockedOutsideWait) {
+  sigset_t mask;
+  sigprocmask(SIG_BLOCK, NULL, &mask);
+  EXPECT_TRUE(sigismember(&mask, SIGTERM));
+
+  Subprocess* subproc = new Subprocess;
+  EXPECT_TRUE(subproc->Start(&subprocs_, "grep SigBlk /proc/self/status"));
+  subprocs_.Add(subproc);
+  while (!subproc->Done())
+    subprocs_.DoWork();
+  ASSERT_TRUE(subproc->Finish());
+  EXPECT_EQ("SigBlk:\t0000000000000000\n", subproc->GetOutput());
+  delete subproc;
+
+  // Nothing is running, so only the pending signal can end the wait.
+  kill(getpid(), SIGTERM);
+  EXPECT_TRUE(subprocs_.DoWork());
+}
+#endif
+#endif
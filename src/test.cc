@@ -39,13 +39,25 @@ void VirtualFileSystem::Create(const string& path, int time,
   files_[path].contents = contents;
 }
 
-int VirtualFileSystem::Stat(const string& path) {
+TimeStamp VirtualFileSystem::Stat(const string& path) {
+  files_statted_.push_back(path);
   FileMap::iterator i = files_.find(path);
   if (i != files_.end())
     return i->second.mtime;
   return 0;
 }
 
+bool VirtualFileSystem::StatIdentity(const string& path,
+                                     FileIdentity* identity) {
+  *identity = FileIdentity();
+  FileMap::iterator i = files_.find(path);
+  if (i != files_.end()) {
+    identity->size = i->second.contents.size();
+    identity->mtime = i->second.mtime;
+  }
+  return true;
+}
+
 bool VirtualFileSystem::MakeDir(const string& path) {
   directories_made_.push_back(path);
   return true;  // success
@@ -43,7 +43,8 @@ struct VirtualFileSystem : public DiskInterface {
   void Create(const string& path, int time, const string& contents);
 
   // DiskInterface
-  virtual int Stat(const string& path);
+  virtual TimeStamp Stat(const string& path);
+  virtual bool StatIdentity(const string& path, FileIdentity* identity);
   virtual bool MakeDir(const string& path);
   virtual string ReadFile(const string& path, string* err);
   virtual int RemoveFile(const string& path);
@@ -56,6 +57,7 @@ struct VirtualFileSystem : public DiskInterface {
 
   vector<string> directories_made_;
   vector<string> files_read_;
+  vector<string> files_statted_;
   typedef map<string, Entry> FileMap;
   FileMap files_;
   set<string> files_removed_;
@@ -0,0 +1,121 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "throttle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "util.h"
+
+namespace {
+
+/// How often to sample.  PSI averages are updated every two seconds.
+const int64_t kSampleMillis = 1000;
+
+/// How long the figures take to show the effect of running fewer
+/// commands: the window of the PSI avg10 figures, and the time constant
+/// of the 1 minute load average.  No further back-off is made meanwhile.
+const int64_t kPressureWindowMillis = 10 * 1000;
+const int64_t kLoadWindowMillis = 60 * 1000;
+
+/// Read the pressure figure from \a path, or a negative number.
+double ReadPressure(const char* path) {
+  string text, err;
+  if (ReadFile(path, &text, &err) < 0)
+    return -1;
+  return ParsePressure(text);
+}
+
+}  // namespace
+
+double ParsePressure(const string& text) {
+  const char kSome[] = "some avg10=";
+  size_t start = text.find(kSome);
+  if (start == string::npos)
+    return -1;
+  return strtod(text.c_str() + start + sizeof(kSome) - 1, NULL);
+}
+
+Throttle::Throttle(int parallelism, double max_load, double max_pressure)
+    : load_(-1), cpu_pressure_(-1), memory_pressure_(-1), io_pressure_(-1),
+      parallelism_(parallelism), max_load_(max_load),
+      max_pressure_(max_pressure), limit_(parallelism),
+      last_sample_millis_(-1), hold_until_millis_(-1) {}
+
+void Throttle::Update(int64_t now_millis) {
+  if (!enabled())
+    return;
+  if (last_sample_millis_ >= 0 &&
+      now_millis - last_sample_millis_ < kSampleMillis)
+    return;
+  last_sample_millis_ = now_millis;
+
+  double load = -1;
+#ifndef _WIN32
+  if (max_load_ > 0 && getloadavg(&load, 1) != 1)
+    load = -1;
+#endif
+  double cpu = -1, memory = -1, io = -1;
+  if (max_pressure_ > 0) {
+    cpu = ReadPressure("/proc/pressure/cpu");
+    memory = ReadPressure("/proc/pressure/memory");
+    io = ReadPressure("/proc/pressure/io");
+  }
+  Adjust(now_millis, load, cpu, memory, io);
+}
+
+void Throttle::Adjust(int64_t now_millis, double load, double cpu,
+                      double memory, double io) {
+  load_ = load;
+  cpu_pressure_ = cpu;
+  memory_pressure_ = memory;
+  io_pressure_ = io;
+
+  bool load_saturated = max_load_ > 0 && load >= max_load_;
+  bool pressure_saturated =
+      max_pressure_ > 0 && max(cpu, max(memory, io)) >= max_pressure_;
+
+  // Back off quickly and recover slowly, so that builds sharing a host
+  // settle rather than all ramping up together.  After backing off, wait
+  // for the figures to catch up before judging the new limit.
+  if (load_saturated || pressure_saturated) {
+    if (now_millis < hold_until_millis_)
+      return;
+    limit_ = max(1, limit_ - max(1, limit_ / 4));
+    hold_until_millis_ = now_millis + (pressure_saturated ?
+        kPressureWindowMillis : kLoadWindowMillis);
+  } else if (limit_ < parallelism_) {
+    ++limit_;
+  }
+}
+
+string Throttle::Describe() const {
+  char buf[128];
+  int len = snprintf(buf, sizeof(buf), "-j%d/%d", limit_, parallelism_);
+  if (load_ >= 0)
+    len += snprintf(buf + len, sizeof(buf) - len, " load %.1f", load_);
+  const double pressures[] = { cpu_pressure_, memory_pressure_,
+                               io_pressure_ };
+  const char* const names[] = { "cpu", "mem", "io" };
+  for (int i = 0; i < 3; ++i) {
+    if (pressures[i] >= 0) {
+      len += snprintf(buf + len, sizeof(buf) - len, " %s %.0f%%",
+                      names[i], pressures[i]);
+    }
+  }
+  return buf;
+}
@@ -0,0 +1,85 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_THROTTLE_H_
+#define NINJA_THROTTLE_H_
+
+#include <stdint.h>
+
+#include <string>
+using namespace std;
+
+/// Throttle lowers the number of commands run at once while the machine
+/// is saturated, and raises it again as the pressure falls, for hosts
+/// shared between builds.
+///
+/// It watches the load average and, on Linux, the pressure stall
+/// information (PSI) in /proc/pressure: the share of the last ten seconds
+/// in which some task waited for CPU, memory or IO.  While either is over
+/// its maximum, the limit drops by a quarter, then holds for as long as
+/// the figure takes to reflect the cut (10 seconds for pressure, a
+/// minute for the load average) before it may drop again.  Otherwise it
+/// climbs back by one a sample.
+///
+/// Samples are taken at most once a second, and only as ninja looks to
+/// start a command, i.e. when one starts or finishes; while a long
+/// command runs alone, the limit stays put.
+struct Throttle {
+  /// Run up to \a parallelism commands, fewer while the load average is
+  /// over \a max_load or any pressure is over \a max_pressure percent.
+  /// A maximum of 0 or less isn't checked.
+  Throttle(int parallelism, double max_load, double max_pressure);
+
+  /// Whether any maximum is being checked.
+  bool enabled() const { return max_load_ > 0 || max_pressure_ > 0; }
+
+  /// The number of commands that may run now.
+  int limit() const { return limit_; }
+  int parallelism() const { return parallelism_; }
+
+  /// Take a sample and adjust limit(), if enough time has passed since
+  /// the last one.
+  void Update(int64_t now_millis);
+
+  /// Adjust limit() for a sample, taken at \a now_millis, of the load
+  /// average and the CPU, memory and IO pressures.  Figures below 0 are
+  /// unavailable.
+  void Adjust(int64_t now_millis, double load, double cpu, double memory,
+              double io);
+
+  /// Describe the last sample and the limit, for the status line.
+  string Describe() const;
+
+  /// The last sample; below 0 if unavailable.
+  double load_;
+  double cpu_pressure_;
+  double memory_pressure_;
+  double io_pressure_;
+
+ private:
+  int parallelism_;
+  double max_load_;
+  double max_pressure_;
+  int limit_;
+  /// When the last sample was taken, or -1 before the first.
+  int64_t last_sample_millis_;
+  /// Until when not to back off again after backing off.
+  int64_t hold_until_millis_;
+};
+
+/// Parse the "some avg10" figure from the contents \a text of a
+/// /proc/pressure file.  Returns a negative number if it isn't there.
+double ParsePressure(const string& text);
+
+#endif  // NINJA_THROTTLE_H_
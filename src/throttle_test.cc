@@ -0,0 +1,93 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "throttle.h"
+
+#include <gtest/gtest.h>
+
+TEST(Throttle, ParsePressure) {
+  EXPECT_EQ(12.5, ParsePressure(
+      "some avg10=12.50 avg60=31.19 avg300=44.85 total=3607284840\n"
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"));
+  EXPECT_GT(0, ParsePressure(""));
+}
+
+TEST(Throttle, Disabled) {
+  Throttle throttle(8, 0, 0);
+  EXPECT_FALSE(throttle.enabled());
+  throttle.Update(0);
+  EXPECT_EQ(8, throttle.limit());
+}
+
+TEST(Throttle, BackOffAndRecover) {
+  Throttle throttle(16, 10, 50);
+  EXPECT_TRUE(throttle.enabled());
+
+  // Down by a quarter for each saturated sample that is far enough
+  // apart, but not below one.
+  int64_t now = 0;
+  throttle.Adjust(now, 12, -1, -1, -1);
+  EXPECT_EQ(12, throttle.limit());
+  now += 60000;
+  throttle.Adjust(now, 5, 10, 60, 0);
+  EXPECT_EQ(9, throttle.limit());
+  for (int i = 0; i < 20; ++i) {
+    now += 10000;
+    throttle.Adjust(now, 20, 90, 0, 0);
+  }
+  EXPECT_EQ(1, throttle.limit());
+
+  // Back up by one a sample, as far as the -j.
+  now += 1000;
+  throttle.Adjust(now, 5, 10, 0, 0);
+  EXPECT_EQ(2, throttle.limit());
+  for (int i = 0; i < 20; ++i) {
+    now += 1000;
+    throttle.Adjust(now, 5, 10, 0, 0);
+  }
+  EXPECT_EQ(16, throttle.limit());
+}
+
+TEST(Throttle, HoldOff) {
+  Throttle throttle(16, 10, 50);
+
+  // The pressure figures cover ten seconds, so a cut isn't followed by
+  // another until they have had that long to reflect it.
+  throttle.Adjust(0, 5, 90, 0, 0);
+  EXPECT_EQ(12, throttle.limit());
+  for (int64_t now = 1000; now < 10000; now += 1000) {
+    throttle.Adjust(now, 5, 90, 0, 0);
+    EXPECT_EQ(12, throttle.limit());
+  }
+  throttle.Adjust(10000, 5, 90, 0, 0);
+  EXPECT_EQ(9, throttle.limit());
+
+  // The load average takes a minute.
+  throttle.Adjust(20000, 12, 10, 0, 0);
+  EXPECT_EQ(7, throttle.limit());
+  throttle.Adjust(50000, 12, 10, 0, 0);
+  EXPECT_EQ(7, throttle.limit());
+  throttle.Adjust(80000, 12, 10, 0, 0);
+  EXPECT_EQ(6, throttle.limit());
+
+  // Recovering isn't held off.
+  throttle.Adjust(81000, 5, 10, 0, 0);
+  EXPECT_EQ(7, throttle.limit());
+}
+
+TEST(Throttle, Describe) {
+  Throttle throttle(8, 4, 50);
+  throttle.Adjust(0, 5.25, 60, -1, 2);
+  EXPECT_EQ("-j6/8 load 5.2 cpu 60% io 2%", throttle.Describe());
+}
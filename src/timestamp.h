@@ -0,0 +1,26 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_TIMESTAMP_H_
+#define NINJA_TIMESTAMP_H_
+
+#include <stdint.h>
+
+/// A file modification time, in nanoseconds since the epoch.
+/// 64 bits so that it neither truncates sub-second mtimes nor overflows
+/// in 2038.  As with stat(), 0 means the file is missing and -1 that
+/// the time is unknown.
+typedef int64_t TimeStamp;
+
+#endif  // NINJA_TIMESTAMP_H_
@@ -0,0 +1,168 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "graph.h"
+#include "util.h"
+
+namespace {
+
+/// Lane 0 holds ninja's own phases.
+const int kNinjaLane = 0;
+
+/// When the lane of a running command becomes free: not until it
+/// finishes.
+const int64_t kRunning = 0x7fffffffffffffffLL;
+
+/// Quote \a str as a JSON string.
+string JSONString(const string& str) {
+  string quoted = "\"";
+  for (size_t i = 0; i < str.size(); ++i) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      quoted += buf;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+/// A time in milliseconds as the microseconds that traces use.
+long long Micros(int64_t millis) {
+  return (long long)millis * 1000;
+}
+
+}  // namespace
+
+Trace::Trace()
+    : file_(NULL), owns_file_(false), wrote_event_(false),
+      start_millis_(GetTimeMillis()), named_lanes_(0) {}
+
+Trace::~Trace() {
+  Close();
+}
+
+bool Trace::Open(const string& path, string* err) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    *err = strerror(errno);
+    return false;
+  }
+  Open(file);
+  owns_file_ = true;
+  return true;
+}
+
+void Trace::Open(FILE* file) {
+  file_ = file;
+  owns_file_ = false;
+  fprintf(file_, "[\n");
+}
+
+void Trace::Close() {
+  if (!file_)
+    return;
+  fprintf(file_, "\n]\n");
+  if (owns_file_)
+    fclose(file_);
+  else
+    fflush(file_);
+  file_ = NULL;
+}
+
+int64_t Trace::Now() const {
+  return GetTimeMillis() - start_millis_;
+}
+
+void Trace::NameLane(int tid) {
+  for (; named_lanes_ <= tid; ++named_lanes_) {
+    char name[32];
+    if (named_lanes_ == kNinjaLane)
+      strcpy(name, "ninja");
+    else
+      snprintf(name, sizeof(name), "core %d", named_lanes_);
+    fprintf(file_, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+            "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            wrote_event_ ? ",\n" : "", named_lanes_, name);
+    wrote_event_ = true;
+  }
+}
+
+void Trace::AddPhase(const char* phase, int64_t start, int64_t end) {
+  if (!file_)
+    return;
+  NameLane(kNinjaLane);
+  fprintf(file_, ",\n{\"name\":%s,\"cat\":\"ninja\",\"ph\":\"X\","
+          "\"ts\":%lld,\"dur\":%lld,\"pid\":0,\"tid\":%d}",
+          JSONString(phase).c_str(), Micros(start), Micros(end - start),
+          kNinjaLane);
+}
+
+void Trace::AddCommand(int core, const string& name, const string& rule,
+                       const string& output, int64_t start, int64_t end) {
+  if (!file_)
+    return;
+  NameLane(core);
+  fprintf(file_, ",\n{\"name\":%s,\"cat\":%s,\"ph\":\"X\","
+          "\"ts\":%lld,\"dur\":%lld,\"pid\":0,\"tid\":%d,"
+          "\"args\":{\"output\":%s}}",
+          JSONString(name).c_str(), JSONString(rule).c_str(),
+          Micros(start), Micros(end - start), core,
+          JSONString(output).c_str());
+}
+
+int Trace::ScheduleCore(int64_t start, int64_t end) {
+  size_t i = 0;
+  while (i < core_free_at_.size() && core_free_at_[i] > start)
+    ++i;
+  if (i == core_free_at_.size())
+    core_free_at_.push_back(end);
+  else
+    core_free_at_[i] = end;
+  return i + 1;
+}
+
+void Trace::CommandStarted(Edge* edge) {
+  if (!file_)
+    return;
+  int64_t now = Now();
+  int core = ScheduleCore(now, kRunning);
+  running_[edge] = make_pair(core, now);
+}
+
+void Trace::CommandFinished(Edge* edge) {
+  map<Edge*, pair<int, int64_t> >::iterator i = running_.find(edge);
+  if (i == running_.end())
+    return;
+  int core = i->second.first;
+  int64_t start = i->second.second, end = Now();
+  running_.erase(i);
+  core_free_at_[core - 1] = end;
+
+  string name = edge->GetDescription();
+  if (name.empty())
+    name = edge->EvaluateCommand();
+  AddCommand(core, name, edge->rule_->name_, edge->outputs_[0]->file_->path_,
+             start, end);
+}
@@ -0,0 +1,86 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_TRACE_H_
+#define NINJA_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct Edge;
+
+/// Trace writes the timeline of a build as a Chrome trace-event file,
+/// which chrome://tracing and Perfetto can display.
+///
+/// Commands are drawn on "core" lanes, numbered from 1; a command takes
+/// the lowest-numbered lane that is free when it starts, so gaps in the
+/// lanes show where the build ran fewer commands than it could have.
+/// Ninja's own phases (loading, the dirty scan, waiting for commands)
+/// are drawn on lane 0.  Times are in milliseconds.
+struct Trace {
+  Trace();
+  ~Trace();
+
+  /// Start writing a trace to \a path.
+  bool Open(const string& path, string* err);
+  /// Start writing a trace to \a file, which is left open by Close().
+  void Open(FILE* file);
+  /// Finish the trace.
+  void Close();
+
+  /// The time since the trace was created.
+  int64_t Now() const;
+
+  /// Record that ninja was busy with \a phase from \a start to \a end.
+  void AddPhase(const char* phase, int64_t start, int64_t end);
+
+  /// Record a command that ran on lane \a core.  It is named \a name and
+  /// categorized by \a rule.
+  void AddCommand(int core, const string& name, const string& rule,
+                  const string& output, int64_t start, int64_t end);
+
+  /// Record that \a edge's command started now.
+  void CommandStarted(Edge* edge);
+  /// Record that \a edge's command finished now.
+  void CommandFinished(Edge* edge);
+
+  /// Take the lowest-numbered lane free at \a start, which stays busy
+  /// until \a end.  For commands known after the fact, fed in order of
+  /// their start times.
+  int ScheduleCore(int64_t start, int64_t end);
+
+ private:
+  /// Name lane \a tid, the first time it is used.
+  void NameLane(int tid);
+
+  FILE* file_;
+  bool owns_file_;
+  /// Whether an event has been written, and needs a separating comma.
+  bool wrote_event_;
+  int64_t start_millis_;
+
+  /// The lanes named so far.
+  int named_lanes_;
+  /// For each lane, when it is next free.  Lane 1 is at index 0.
+  vector<int64_t> core_free_at_;
+  /// The lane and start time of each running command.
+  map<Edge*, pair<int, int64_t> > running_;
+};
+
+#endif  // NINJA_TRACE_H_
@@ -0,0 +1,69 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Read back everything written to \a f.
+string Contents(FILE* f) {
+  rewind(f);
+  string contents;
+  char buf[1024];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    contents.append(buf, len);
+  return contents;
+}
+
+}  // namespace
+
+TEST(Trace, ScheduleCore) {
+  Trace trace;
+  EXPECT_EQ(1, trace.ScheduleCore(0, 100));
+  EXPECT_EQ(2, trace.ScheduleCore(10, 50));
+  EXPECT_EQ(3, trace.ScheduleCore(20, 30));
+  // Lane 2 is the first one free again.
+  EXPECT_EQ(2, trace.ScheduleCore(60, 70));
+  EXPECT_EQ(3, trace.ScheduleCore(60, 70));
+  EXPECT_EQ(1, trace.ScheduleCore(100, 200));
+}
+
+TEST(Trace, Events) {
+  FILE* f = tmpfile();
+  ASSERT_TRUE(f);
+  Trace trace;
+  trace.Open(f);
+  trace.AddPhase("load manifest", 0, 5);
+  trace.AddCommand(2, "CC \"a\\b\".o", "cc", "a.o", 5, 7);
+  trace.Close();
+
+  EXPECT_EQ(
+"[\n"
+"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+"\"args\":{\"name\":\"ninja\"}},\n"
+"{\"name\":\"load manifest\",\"cat\":\"ninja\",\"ph\":\"X\","
+"\"ts\":0,\"dur\":5000,\"pid\":0,\"tid\":0},\n"
+"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,"
+"\"args\":{\"name\":\"core 1\"}},\n"
+"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":2,"
+"\"args\":{\"name\":\"core 2\"}},\n"
+"{\"name\":\"CC \\\"a\\\\b\\\".o\",\"cat\":\"cc\",\"ph\":\"X\","
+"\"ts\":5000,\"dur\":2000,\"pid\":0,\"tid\":2,"
+"\"args\":{\"output\":\"a.o\"}}\n"
+"]\n", Contents(f));
+  fclose(f);
+}
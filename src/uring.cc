@@ -0,0 +1,297 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+/// Number of submission queue entries we ask for.
+const unsigned kEntries = 256;
+
+/// How much of each file Read() asks for up front.  Depfiles almost
+/// always fit; the rest of larger files is read synchronously.
+const size_t kReadSize = 64 << 10;
+
+}  // namespace
+
+Uring::Uring()
+    : fd_(-1), entries_(0), sq_ring_(MAP_FAILED), sq_ring_size_(0),
+      sq_tail_(NULL), sq_mask_(NULL), sq_array_(NULL), sqes_(NULL),
+      sqes_size_(0), cq_ring_(MAP_FAILED), cq_ring_size_(0), cq_head_(NULL),
+      cq_tail_(NULL), cq_mask_(NULL), cqes_(NULL) {}
+
+Uring::~Uring() {
+  if (sqes_)
+    munmap(sqes_, sqes_size_);
+  if (cq_ring_ != MAP_FAILED)
+    munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_ != MAP_FAILED)
+    munmap(sq_ring_, sq_ring_size_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool Uring::Init() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  fd_ = syscall(__NR_io_uring_setup, kEntries, &params);
+  if (fd_ < 0)
+    return false;
+  entries_ = params.sq_entries;
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED)
+    return false;
+  char* sq = (char*)sq_ring_;
+  sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+  sq_mask_ = (unsigned*)(sq + params.sq_off.ring_mask);
+  sq_array_ = (unsigned*)(sq + params.sq_off.array);
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return false;
+  sqes_ = (io_uring_sqe*)sqes;
+
+  cq_ring_size_ = params.cq_off.cqes +
+      params.cq_entries * sizeof(io_uring_cqe);
+  cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+  if (cq_ring_ == MAP_FAILED)
+    return false;
+  char* cq = (char*)cq_ring_;
+  cq_head_ = (unsigned*)(cq + params.cq_off.head);
+  cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+  cq_mask_ = (unsigned*)(cq + params.cq_off.ring_mask);
+  cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+  return true;
+}
+
+bool Uring::Run(size_t count, Op* op) {
+  if (fd_ < 0)
+    return false;
+
+  size_t next = 0;
+  unsigned queued = 0;  // Prepared, but not yet consumed by the kernel.
+  unsigned in_flight = 0;
+  while (next < count || queued || in_flight) {
+    // Fill the submission queue.
+    unsigned tail = *sq_tail_;
+    while (next < count && queued + in_flight < entries_) {
+      unsigned index = tail & *sq_mask_;
+      io_uring_sqe* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      if (op->Prepare(next, sqe)) {
+        sqe->user_data = next;
+        sq_array_[index] = index;
+        ++tail;
+        ++queued;
+      }
+      ++next;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    if (!queued && !in_flight)
+      break;  // Everything left was skipped.
+
+    // Submit, and wait for at least one completion.
+    int ret;
+    do {
+      ret = syscall(__NR_io_uring_enter, fd_, queued, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+      // Whatever is still in flight would confuse later calls.
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+    queued -= ret;
+    in_flight += ret;
+
+    // Reap completions.
+    unsigned head = *cq_head_;
+    unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != cq_tail; ++head) {
+      io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+      op->Complete(cqe->user_data, cqe->res);
+      --in_flight;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+  return true;
+}
+
+namespace {
+
+struct StatOp : public Uring::Op {
+  StatOp(const vector<string>& paths, vector<TimeStamp>* mtimes)
+      : paths_(paths), mtimes_(mtimes), bufs_(paths.size()) {}
+
+  virtual bool Prepare(size_t i, io_uring_sqe* sqe) {
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)paths_[i].c_str();
+    sqe->len = STATX_MTIME;
+    sqe->off = (uintptr_t)&bufs_[i];
+    return true;
+  }
+
+  virtual void Complete(size_t i, int res) {
+    if (res == 0 && (bufs_[i].stx_mask & STATX_MTIME)) {
+      (*mtimes_)[i] = (TimeStamp)bufs_[i].stx_mtime.tv_sec * 1000000000LL +
+          bufs_[i].stx_mtime.tv_nsec;
+    } else if (res == -ENOENT) {
+      (*mtimes_)[i] = 0;
+    }
+  }
+
+  const vector<string>& paths_;
+  vector<TimeStamp>* mtimes_;
+  vector<struct statx> bufs_;
+};
+
+/// Reads a chunk of files in three passes: open, read, close.
+struct ReadOp : public Uring::Op {
+  enum Pass { OPEN, READ, CLOSE };
+
+  ReadOp(const string* paths, string* contents, vector<bool>::iterator ok,
+         size_t count)
+      : paths_(paths), contents_(contents), ok_(ok), fds_(count, -1),
+        pass_(OPEN) {}
+
+  virtual bool Prepare(size_t i, io_uring_sqe* sqe) {
+    switch (pass_) {
+    case OPEN:
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uintptr_t)paths_[i].c_str();
+      sqe->open_flags = O_RDONLY | O_CLOEXEC;
+      return true;
+    case READ:
+      if (fds_[i] < 0)
+        return false;
+      contents_[i].resize(kReadSize);
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = fds_[i];
+      sqe->addr = (uintptr_t)&contents_[i][0];
+      sqe->len = kReadSize;
+      sqe->off = 0;
+      return true;
+    case CLOSE:
+      if (fds_[i] < 0)
+        return false;
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = fds_[i];
+      return true;
+    }
+    return false;
+  }
+
+  virtual void Complete(size_t i, int res) {
+    switch (pass_) {
+    case OPEN:
+      if (res >= 0) {
+        fds_[i] = res;
+      } else if (res == -ENOENT) {
+        ok_[i] = true;
+      }
+      break;
+    case READ:
+      if (res >= 0) {
+        contents_[i].resize(res);
+        ok_[i] = ((size_t)res < kReadSize) || ReadRest(i);
+      }
+      break;
+    case CLOSE:
+      // Kernels that can't close through io_uring fail with EINVAL.
+      if (res < 0)
+        close(fds_[i]);
+      fds_[i] = -1;
+      break;
+    }
+  }
+
+  /// Read the part of a file that didn't fit in the first read.
+  bool ReadRest(size_t i) {
+    char buf[kReadSize];
+    ssize_t len;
+    while ((len = pread(fds_[i], buf, sizeof(buf),
+                        contents_[i].size())) > 0)
+      contents_[i].append(buf, len);
+    return len == 0;
+  }
+
+  /// Close whatever is still open, e.g. if the ring broke.
+  void CloseAll() {
+    for (size_t i = 0; i < fds_.size(); ++i) {
+      if (fds_[i] >= 0)
+        close(fds_[i]);
+      fds_[i] = -1;
+    }
+  }
+
+  const string* paths_;
+  string* contents_;
+  vector<bool>::iterator ok_;
+  vector<int> fds_;
+  Pass pass_;
+};
+
+}  // namespace
+
+void Uring::Stat(const vector<string>& paths, vector<TimeStamp>* mtimes) {
+  mtimes->assign(paths.size(), -1);
+  StatOp op(paths, mtimes);
+  Run(paths.size(), &op);
+}
+
+void Uring::Read(const vector<string>& paths, vector<string>* contents,
+                 vector<bool>* ok) {
+  contents->assign(paths.size(), string());
+  ok->assign(paths.size(), false);
+  // Work in chunks to bound the memory used by read buffers.
+  for (size_t start = 0; start < paths.size(); start += entries_) {
+    size_t count = min((size_t)entries_, paths.size() - start);
+    ReadOp op(&paths[start], &(*contents)[start], ok->begin() + start, count);
+    bool ran = Run(count, &op);
+    if (ran) {
+      op.pass_ = ReadOp::READ;
+      ran = Run(count, &op);
+    }
+    if (ran) {
+      op.pass_ = ReadOp::CLOSE;
+      ran = Run(count, &op);
+    }
+    if (!ran) {
+      op.CloseAll();
+      for (size_t i = start; i < start + count; ++i)
+        (*ok)[i] = false;
+    }
+  }
+}
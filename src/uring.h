@@ -0,0 +1,87 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_URING_H_
+#define NINJA_URING_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "timestamp.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/// Uring submits batches of stat()s and file reads to the kernel at once
+/// through io_uring, instead of making one system call per file.  Linux
+/// only.
+///
+/// Operations that fail for any reason other than the file missing are
+/// reported as failed rather than retried, so that callers can redo them
+/// synchronously and report errors the usual way.
+struct Uring {
+  Uring();
+  ~Uring();
+
+  /// Set up the ring.  Returns false if io_uring is unavailable, e.g.
+  /// because the kernel is too old or it's disabled by a sandbox.
+  bool Init();
+
+  /// Get the mtimes of \a paths into \a mtimes: 0 for missing files, and
+  /// -1 for paths that failed.
+  void Stat(const vector<string>& paths, vector<TimeStamp>* mtimes);
+
+  /// Read the contents of \a paths into \a contents.  Missing files read
+  /// as empty.  \a ok is set to false for paths that failed.
+  void Read(const vector<string>& paths, vector<string>* contents,
+            vector<bool>* ok);
+
+  /// Callbacks for Run().
+  struct Op {
+    virtual ~Op() {}
+    /// Fill in \a sqe for item \a i.  Return false to skip the item.
+    virtual bool Prepare(size_t i, io_uring_sqe* sqe) = 0;
+    /// Handle the result of item \a i.
+    virtual void Complete(size_t i, int res) = 0;
+  };
+
+ private:
+  /// Run \a op on items [0, \a count), keeping the ring as full as
+  /// possible.  Returns false if the ring broke; items that haven't
+  /// completed by then are never passed to Complete().
+  bool Run(size_t count, Op* op);
+
+  int fd_;
+  unsigned entries_;
+
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  io_uring_cqe* cqes_;
+};
+
+#endif  // NINJA_URING_H_
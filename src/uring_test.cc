@@ -0,0 +1,85 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "uring.h"
+
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include "disk_interface.h"
+
+namespace {
+
+struct UringTest : public testing::Test {
+  virtual void SetUp() {
+    char name_template[] = "/tmp/UringTest-XXXXXX";
+    ASSERT_TRUE(mkdtemp(name_template));
+    temp_dir_ = name_template;
+  }
+  virtual void TearDown() {
+    ASSERT_EQ(0, system(("rm -rf " + temp_dir_).c_str()));
+  }
+
+  /// Write \a contents to \a name in the temporary directory.
+  string Create(const string& name, const string& contents) {
+    string path = temp_dir_ + "/" + name;
+    FILE* f = fopen(path.c_str(), "wb");
+    fwrite(contents.data(), 1, contents.size(), f);
+    fclose(f);
+    return path;
+  }
+
+  string temp_dir_;
+};
+
+TEST_F(UringTest, StatAndRead) {
+  Uring uring;
+  if (!uring.Init())
+    return;  // Not supported here; callers fall back to plain syscalls.
+
+  // More files than fit in the ring at once, and one larger than a single
+  // read.
+  vector<string> paths;
+  for (int i = 0; i < 300; ++i) {
+    char name[16];
+    sprintf(name, "f%d", i);
+    paths.push_back(Create(name, name));
+  }
+  string big(200 << 10, 'x');
+  paths.push_back(Create("big", big));
+  paths.push_back(temp_dir_ + "/missing");
+  paths.push_back(temp_dir_ + "/f0/not_a_dir");
+
+  vector<TimeStamp> mtimes;
+  uring.Stat(paths, &mtimes);
+  ASSERT_EQ(paths.size(), mtimes.size());
+  RealDiskInterface disk;
+  for (size_t i = 0; i < paths.size(); ++i)
+    EXPECT_EQ(disk.Stat(paths[i]), mtimes[i]) << paths[i];
+
+  vector<string> contents;
+  vector<bool> ok;
+  uring.Read(paths, &contents, &ok);
+  ASSERT_EQ(paths.size(), contents.size());
+  EXPECT_EQ("f0", contents[0]);
+  EXPECT_EQ("f299", contents[299]);
+  EXPECT_EQ(big, contents[300]);
+  EXPECT_EQ("", contents[301]);
+  for (size_t i = 0; i <= 301; ++i)
+    EXPECT_TRUE(ok[i]) << paths[i];
+  EXPECT_FALSE(ok[302]);
+}
+
+}  // namespace
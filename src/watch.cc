@@ -0,0 +1,220 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "watch.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "graph.h"
+#include "state.h"
+#include "util.h"
+
+namespace {
+
+/// Events that may change a file's mtime or existence.
+const uint32_t kWatchMask = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE |
+    IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+/// How long to wait for further events once something changed, so that
+/// e.g. an editor's write-then-rename save results in a single rebuild.
+const int kSettleMillis = 20;
+
+string DirName(const string& path) {
+  string::size_type slash_pos = path.rfind('/');
+  if (slash_pos == string::npos)
+    return ".";
+  if (slash_pos == 0)
+    return "/";
+  return path.substr(0, slash_pos);
+}
+
+string JoinPath(const string& dir, const char* name) {
+  if (dir == ".")
+    return name;
+  if (dir == "/")
+    return dir + name;
+  return dir + "/" + name;
+}
+
+}  // anonymous namespace
+
+Watcher::Watcher(State* state)
+    : state_(state), fd_(-1), warned_limit_(false) {}
+
+Watcher::~Watcher() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool Watcher::Start(string* err) {
+  fd_ = inotify_init();
+  if (fd_ < 0) {
+    *err = string("inotify_init: ") + strerror(errno);
+    return false;
+  }
+  SetCloseOnExec(fd_);
+  AddWatches();
+  return true;
+}
+
+void Watcher::AddWatches() {
+  set<string> tried;
+  StatCache::Paths& paths = state_->stat_cache()->paths_;
+  for (StatCache::Paths::iterator i = paths.begin(); i != paths.end(); ++i) {
+    if (!i->second->node_)
+      continue;
+    string dir = DirName(i->second->path_);
+    if (tried.insert(dir).second)
+      WatchDir(dir);
+  }
+  for (set<string>::iterator i = watched_files_.begin();
+       i != watched_files_.end(); ++i) {
+    string dir = DirName(*i);
+    if (tried.insert(dir).second)
+      WatchDir(dir);
+  }
+}
+
+void Watcher::WatchFile(const string& path) {
+  watched_files_.insert(path);
+  WatchDir(DirName(path));
+}
+
+bool Watcher::WatchDir(const string& dir) {
+  if (watched_dirs_.count(dir))
+    return true;
+  int wd = inotify_add_watch(fd_, dir.c_str(), kWatchMask);
+  if (wd < 0) {
+    // Missing directories are retried by AddWatches(), as the build may
+    // create them.
+    if (errno == ENOSPC && !warned_limit_) {
+      Warning("inotify watch limit reached; some changes will be missed "
+              "(see /proc/sys/fs/inotify/max_user_watches)");
+      warned_limit_ = true;
+    }
+    return false;
+  }
+  wd_to_dir_[wd] = dir;
+  watched_dirs_.insert(dir);
+  return true;
+}
+
+bool Watcher::WaitForChanges(vector<string>* changed, string* err) {
+  char buf[64 << 10];
+  bool any_changes = false;
+  for (;;) {
+    // Once something has changed, only keep reading while events keep
+    // coming in.
+    if (any_changes) {
+      pollfd pfd = { fd_, POLLIN, 0 };
+      int ret = poll(&pfd, 1, kSettleMillis);
+      if (ret < 0 && errno != EINTR) {
+        *err = string("poll: ") + strerror(errno);
+        return false;
+      }
+      if (ret <= 0)
+        return true;
+    }
+
+    ssize_t len = read(fd_, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      *err = string("read: ") + strerror(errno);
+      return false;
+    }
+    if (HandleEvents(buf, len, false, changed))
+      any_changes = true;
+  }
+}
+
+bool Watcher::ReadBuildEvents(vector<string>* changed, string* err) {
+  char buf[64 << 10];
+  for (;;) {
+    pollfd pfd = { fd_, POLLIN, 0 };
+    int ret = poll(&pfd, 1, 0);
+    if (ret < 0 && errno != EINTR) {
+      *err = string("poll: ") + strerror(errno);
+      return false;
+    }
+    if (ret <= 0)
+      return true;
+
+    ssize_t len = read(fd_, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      *err = string("read: ") + strerror(errno);
+      return false;
+    }
+    HandleEvents(buf, len, true, changed);
+  }
+}
+
+bool Watcher::HandleEvents(const char* buf, ssize_t len, bool during_build,
+                           vector<string>* changed) {
+  bool any_changes = false;
+  const char* p = buf;
+  while (p < buf + len) {
+    const inotify_event* event = (const inotify_event*)p;
+    p += sizeof(inotify_event) + event->len;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+      // We lost track of what changed; forget everything.
+      state_->Reset();
+      any_changes = true;
+      continue;
+    }
+
+    map<int, string>::iterator i = wd_to_dir_.find(event->wd);
+    if (i == wd_to_dir_.end())
+      continue;
+    if (event->mask & IN_IGNORED) {
+      // The directory went away; AddWatches() will retry it.
+      watched_dirs_.erase(i->second);
+      wd_to_dir_.erase(i);
+      continue;
+    }
+    if (!event->len)
+      continue;
+
+    string path = JoinPath(i->second, event->name);
+    StatCache::Paths& paths = state_->stat_cache()->paths_;
+    StatCache::Paths::iterator file = paths.find(path.c_str());
+    Node* node = file == paths.end() ? NULL : file->second->node_;
+    if (!node) {
+      // Files watched outside the graph have no node to reset.
+      if (watched_files_.count(path)) {
+        changed->push_back(path);
+        any_changes = true;
+      }
+      continue;  // Otherwise not a file we care about, e.g. a swap file.
+    }
+
+    // Outputs written by the build itself were already reset after it
+    // finished; they don't call for another build.
+    if (during_build && !node->file_->status_known() && node->in_edge_ &&
+        !node->in_edge_->is_phony())
+      continue;
+
+    state_->ResetNode(node);
+    changed->push_back(path);
+    any_changes = true;
+  }
+  return any_changes;
+}
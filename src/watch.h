@@ -0,0 +1,74 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_WATCH_H_
+#define NINJA_WATCH_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct State;
+
+/// Watcher uses inotify to watch the directories of all the files in a
+/// State, so that a State kept across builds can be updated with just the
+/// files that changed (see State::ResetNode).  Files outside the State,
+/// such as the manifest, can be watched too.  Linux only.
+struct Watcher {
+  explicit Watcher(State* state);
+  ~Watcher();
+
+  /// Start watching.  Fills in \a err on error.
+  bool Start(string* err);
+
+  /// Watch the directories of files added to the State since the last call,
+  /// e.g. from depfiles, and retry those that didn't exist yet.
+  void AddWatches();
+
+  /// Also watch \a path, which needn't be in the State; changes to it are
+  /// reported like those to nodes.
+  void WatchFile(const string& path);
+
+  /// Block until a file in the State changes, and reset the nodes of the
+  /// files that changed.  Their paths are appended to \a changed.
+  /// Fills in \a err on error.
+  bool WaitForChanges(vector<string>* changed, string* err);
+
+  /// Like WaitForChanges(), but only handle the events queued while a build
+  /// was running, without blocking.  Events for the outputs the build wrote
+  /// are skipped, as those nodes were already reset.
+  bool ReadBuildEvents(vector<string>* changed, string* err);
+
+ private:
+  /// Handle the events in \a buf.  Returns true if anything in the State
+  /// changed.
+  bool HandleEvents(const char* buf, ssize_t len, bool during_build,
+                    vector<string>* changed);
+
+  /// Watch \a dir, unless it already is.  Returns false if it can't be
+  /// watched (yet).
+  bool WatchDir(const string& dir);
+
+  State* state_;
+  int fd_;
+  map<int, string> wd_to_dir_;
+  set<string> watched_dirs_;
+  /// The files passed to WatchFile().
+  set<string> watched_files_;
+  bool warned_limit_;
+};
+
+#endif  // NINJA_WATCH_H_
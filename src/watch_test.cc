@@ -0,0 +1,94 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "watch.h"
+
+#include <stdlib.h>
+
+#include "graph.h"
+#include "test.h"
+
+namespace {
+
+struct WatchTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    char name_template[] = "/tmp/WatchTest-XXXXXX";
+    ASSERT_TRUE(mkdtemp(name_template));
+    temp_dir_ = name_template;
+  }
+  virtual void TearDown() {
+    ASSERT_EQ(0, system(("rm -rf " + temp_dir_).c_str()));
+  }
+
+  string temp_dir_;
+};
+
+TEST_F(WatchTest, ResetsChangedNodes) {
+  string in = temp_dir_ + "/in";
+  string other = temp_dir_ + "/other";
+  string out = temp_dir_ + "/out";
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+      ("build " + out + ": cat " + in + " " + other + "\n").c_str()));
+  GetNode(in)->file_->mtime_ = 1;
+  GetNode(other)->file_->mtime_ = 1;
+  GetNode(out)->file_->mtime_ = 1;
+
+  Watcher watcher(&state_);
+  string err;
+  ASSERT_TRUE(watcher.Start(&err));
+  ASSERT_EQ("", err);
+
+  // Changes to files that aren't in the graph are ignored.
+  ASSERT_EQ(0, system(("touch " + temp_dir_ + "/unrelated " + in).c_str()));
+
+  vector<string> changed;
+  ASSERT_TRUE(watcher.WaitForChanges(&changed, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(in, changed[0]);
+  EXPECT_FALSE(GetNode(in)->file_->status_known());
+  EXPECT_FALSE(GetNode(out)->file_->status_known());
+  EXPECT_TRUE(GetNode(other)->file_->status_known());
+}
+
+TEST_F(WatchTest, ReportsWatchedFilesOutsideTheGraph) {
+  string in = temp_dir_ + "/in";
+  string out = temp_dir_ + "/out";
+  string manifest = temp_dir_ + "/build.ninja";
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+      ("build " + out + ": cat " + in + "\n").c_str()));
+  GetNode(in)->file_->mtime_ = 1;
+  GetNode(out)->file_->mtime_ = 1;
+
+  Watcher watcher(&state_);
+  string err;
+  ASSERT_TRUE(watcher.Start(&err));
+  ASSERT_EQ("", err);
+  watcher.WatchFile(manifest);
+
+  // The manifest isn't a node, but is reported all the same.
+  ASSERT_EQ(0, system(("touch " + temp_dir_ + "/unrelated " +
+                       manifest).c_str()));
+
+  vector<string> changed;
+  ASSERT_TRUE(watcher.WaitForChanges(&changed, &err));
+  ASSERT_EQ("", err);
+  // Creating the file may be reported more than once.
+  ASSERT_FALSE(changed.empty());
+  for (size_t i = 0; i < changed.size(); ++i)
+    EXPECT_EQ(manifest, changed[i]);
+  EXPECT_TRUE(GetNode(in)->file_->status_known());
+  EXPECT_TRUE(GetNode(out)->file_->status_known());
+}
+
+}  // anonymous namespace